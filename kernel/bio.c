@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,32 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets.
+// Each bucket has its own spin-lock and its own LRU list, so
+// lookups of blocks that hash to different buckets never
+// contend.  A buffer stays in the bucket of the block it holds
+// while its refcnt is non-zero; only an unused buffer may be
+// moved to another bucket when it is recycled.
+//
+// Buffers hold bsize bytes, BSIZE until fsinit() finds the file
+// system's block size in the super block and calls bsetsize().
+// Buffer data lives in pages from kalloc().  Each page holds
+// BPP buffers, which form a page group linked through sib.
+// The cache starts with NBUF buffers (more if the log asks for
+// them with bsetmin()) and grows a page group at
+// a time, up to 1/BCACHEFRAC of the memory free at boot, while
+// misses occur and memory is plentiful.  When kalloc() runs dry
+// it calls bshrink(), which hands the pages of idle groups back.
+//
+// Unused buffers are recycled with the 2Q policy, so that one
+// big sequential read or write doesn't push out the metadata
+// blocks everything else needs.  Each bucket keeps two LRU
+// lists: cold, for blocks used once, and hot, for metadata and
+// for file data used again after BCORRELATE ticks.  Buffers are
+// recycled from cold while it holds more than 1/BCOLDFRAC of the
+// bucket, and from hot otherwise.  Building with BCACHE_LRU
+// defined (make BCACHE_POLICY=lru) uses plain LRU instead.
 
 
 #include "types.h"
@@ -22,68 +48,454 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
+
+#define NBUCKET 251
+#define BHASH(dev, blockno) (((dev) + (blockno)) % NBUCKET)
+
+#define BPP (PGSIZE / bsize)  // buffers per data page
+#define BRESERVE 64           // don't grow if fewer free pages than this
+#define BSHRINK 4             // page groups freed per bshrink()
+#define BCOLDFRAC 4           // 2Q: cold list's share of a bucket
+#define BCORRELATE 1          // 2Q: ticks before a reuse counts
+
+struct bucket {
+  struct spinlock lock;
+
+  // Linked lists of buffers in this bucket, through prev/next.
+  // head.next is most recently used.  Only cold is used by LRU.
+  struct buf cold;
+  struct buf hot;
+  int ncold;
+  int nhot;
+
+  // counters for blocks in this bucket; bcachestat() adds
+  // them up.  the buffer counts aren't kept here.
+  struct bcachestat stat;
+};
 
 struct {
+  // Serializes growing, shrinking, and recycling of buffers
+  // across buckets, so that whoever holds it may take more
+  // than one bucket lock without risking deadlock.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  struct buf *groups;   // page groups, through leader's gnext
+  struct buf *freehdr;  // unused buf headers, through next
+  int nfreehdr;
+  int nbuf;             // buffers in the cache
+  int minbuf;           // floor on nbuf, NBUF or set by bsetmin()
+  int maxbuf;           // limit on nbuf, set at boot
 } bcache;
 
+uint bsize = BSIZE;     // bytes in a block, and in a buffer
+
+// Insert b at the MRU end of bucket bk's hot or cold list.
+// Caller must hold bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b, int hot)
+{
+  struct buf *head = hot ? &bk->hot : &bk->cold;
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  b->bucket = bk - bcache.bucket;
+  b->hot = hot;
+  if(hot)
+    bk->nhot++;
+  else
+    bk->ncold++;
+}
+
+// Insert b at the LRU end of bucket bk's cold list, so it is
+// recycled first.  Caller must hold bk->lock.
+static void
+bpushtail(struct bucket *bk, struct buf *b)
+{
+  b->prev = bk->cold.prev;
+  b->next = &bk->cold;
+  bk->cold.prev->next = b;
+  bk->cold.prev = b;
+  b->bucket = bk - bcache.bucket;
+  b->hot = 0;
+  bk->ncold++;
+}
+
+// Unlink b from whatever bucket it is in.
+// Caller must hold that bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  if(b->hot)
+    bk->nhot--;
+  else
+    bk->ncold--;
+}
+
+// Put b, which has just become unused, back at the MRU end of
+// bucket bk.  use is 0 if b was only read ahead.
+// Caller must hold bk->lock, and b must be unlinked.
+static void
+bplace(struct bucket *bk, struct buf *b, int use)
+{
+#ifdef BCACHE_LRU
+  bpush(bk, b, 0);
+#else
+  int hot = b->hot;
+
+  // reuse within BCORRELATE ticks, such as a small read
+  // followed by the next small read of the same block,
+  // counts as a single use.
+  if(use){
+    if(!b->filedata)
+      hot = 1;
+    else if(!b->used){
+      b->used = 1;
+      b->usetick = ticks;
+    } else if(ticks - b->usetick >= BCORRELATE)
+      hot = 1;
+  }
+  bpush(bk, b, hot);
+#endif
+}
+
+// Carve a kalloc()ed page into buf headers.
+// Caller must hold bcache.lock.
+static void
+bcarve(char *pa)
+{
+  struct buf *b;
+
+  for(b = (struct buf*)pa; b + 1 <= (struct buf*)(pa + PGSIZE); b++){
+    initsleeplock(&b->lock, "buffer");
+    b->next = bcache.freehdr;
+    bcache.freehdr = b;
+    bcache.nfreehdr++;
+  }
+}
+
+// May the cache take another page from kalloc()?
+static int
+bcangrow(void)
+{
+  return bcache.nbuf < bcache.maxbuf && kfreepages() > BRESERVE;
+}
+
+// Add a page group of empty buffers to the LRU end of bucket bk.
+// Must be called without holding any bcache locks, since it
+// calls kalloc().  Does nothing if the cache is full or memory
+// is short.
+static void
+bgrow(struct bucket *bk)
+{
+  char *pa, *hpa;
+  struct buf *b, *g;
+  int i;
+
+  if((pa = kalloc()) == 0)
+    return;
+
+  acquire(&bcache.lock);
+  if(bcache.nfreehdr < BPP){
+    release(&bcache.lock);
+    if((hpa = kalloc()) == 0){
+      kfree(pa);
+      return;
+    }
+    acquire(&bcache.lock);
+    bcarve(hpa);
+  }
+  if(bcache.nbuf + BPP > bcache.maxbuf){
+    release(&bcache.lock);
+    kfree(pa);
+    return;
+  }
+
+  acquire(&bk->lock);
+  g = 0;
+  for(i = 0; i < BPP; i++){
+    b = bcache.freehdr;
+    bcache.freehdr = b->next;
+    bcache.nfreehdr--;
+
+    b->data = (uchar*)pa + i*bsize;
+    b->dev = 0;   // no device 0; matches no block
+    b->blockno = 0;
+    b->valid = 0;
+    b->disk = 0;
+    b->refcnt = 0;
+    b->filedata = 0;
+    b->used = 0;
+    b->qnext = 0;
+    b->iodone = 0;
+    if(g == 0){
+      g = b;
+      b->sib = b;
+    } else {
+      b->sib = g->sib;
+      g->sib = b;
+    }
+    bpushtail(bk, b);
+  }
+  release(&bk->lock);
+
+  g->gnext = bcache.groups;
+  bcache.groups = g;
+  bcache.nbuf += BPP;
+  release(&bcache.lock);
+}
+
+// Grow the cache to minbuf buffers, spread over the buckets so
+// that each bucket has some buffers of its own to recycle.
+static void
+bfill(void)
+{
+  int i, n;
+
+  for(i = 0; bcache.nbuf < bcache.minbuf; i++){
+    n = bcache.nbuf;
+    bgrow(&bcache.bucket[i % NBUCKET]);
+    if(bcache.nbuf == n)
+      panic("bfill");
+  }
+}
+
+// Size the cache for bsize-byte blocks, and fill it with
+// minbuf empty buffers.
+static void
+bsetup(void)
+{
+  bcache.maxbuf = kfreepages() / BCACHEFRAC * BPP;
+  if(bcache.maxbuf > NBUFMAX)
+    bcache.maxbuf = NBUFMAX;
+  if(bcache.maxbuf < bcache.minbuf)
+    bcache.maxbuf = bcache.minbuf;
+  bcache.maxbuf = (bcache.maxbuf + BPP - 1) / BPP * BPP;
+  bfill();
+}
+
+// Make sure the cache always holds at least n buffers.  Called
+// by initlog(), since every block of a large log stays pinned
+// until it is checkpointed.
+void
+bsetmin(int n)
+{
+  acquire(&bcache.lock);
+  n = (n + BPP - 1) / BPP * BPP;
+  if(n > bcache.minbuf)
+    bcache.minbuf = n;
+  if(bcache.maxbuf < bcache.minbuf)
+    bcache.maxbuf = bcache.minbuf;
+  release(&bcache.lock);
+  bfill();
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  bcache.minbuf = NBUF;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->cold.prev = &bk->cold;
+    bk->cold.next = &bk->cold;
+    bk->hot.prev = &bk->hot;
+    bk->hot.next = &bk->hot;
+  }
+  bsetup();
+}
+
+// Look for block (dev, blockno) in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->hot.next; b != &bk->hot; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  for(b = bk->cold.next; b != &bk->cold; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Find the least recently used unused buffer in list head.
+static struct buf*
+blru(struct buf *head)
+{
+  struct buf *b;
+
+  for(b = head->prev; b != head; b = b->prev){
+    if(b->refcnt == 0)
+      return b;
+  }
+  return 0;
+}
+
+// Choose an unused buffer in bucket bk to recycle.
+// Caller must hold bk->lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b;
+
+  if(bk->ncold * BCOLDFRAC > bk->ncold + bk->nhot){
+    if((b = blru(&bk->cold)) == 0)
+      b = blru(&bk->hot);
+  } else {
+    if((b = blru(&bk->hot)) == 0)
+      b = blru(&bk->cold);
+  }
+  return b;
+}
+
+// Make b, an unused buffer now in bucket bk, hold block
+// (dev, blockno), with no valid data yet.
+// Caller must hold bk->lock.
+static void
+bassign(struct bucket *bk, struct buf *b, uint dev, uint blockno)
+{
+  if(b->valid)
+    bk->stat.evict++;
+  bunlink(b);
+  bpush(bk, b, 0);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->filedata = 0;
+  b->used = 0;
+  b->readahead = 0;
+}
+
+// Count a lookup of b's block that found it cached.
+// Caller must hold bk->lock.
+static void
+bhit(struct bucket *bk, struct buf *b)
+{
+  bk->stat.hit++;
+  if(b->readahead){
+    b->readahead = 0;
+    bk->stat.rahit++;
+  }
+}
+
+// Count a lookup that assigned b to the block.
+// Caller must hold bk->lock.
+static void
+bmiss(struct bucket *bk, struct buf *b, int prefetch)
+{
+  if(prefetch){
+    b->readahead = 1;
+    bk->stat.ra++;
+  } else {
+    bk->stat.miss++;
   }
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (prefetch != 0), return 0 instead if the block
+// is already cached or no buffer is free; a buffer that is
+// returned was unused, so locking it does not sleep.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int prefetch)
 {
   struct buf *b;
+  struct bucket *bk, *victimbk;
+  int h, i;
 
-  acquire(&bcache.lock);
+  h = BHASH(dev, blockno);
+  bk = &bcache.bucket[h];
+
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
+      return 0;
     }
+    bhit(bk, b);
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer from this bucket,
+  // unless the cache may still grow.
+  if(!bcangrow() && (b = bvictim(bk)) != 0){
+    bassign(bk, b, dev, blockno);
+    bmiss(bk, b, prefetch);
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  if(bcangrow())
+    bgrow(bk);
+
+  // Take a fresh or unused buffer from this bucket, or steal
+  // one from another bucket.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // The block may have been cached, or a buffer in this bucket
+  // released, while we held no bucket lock.
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      b = 0;
+      goto out;
+    }
+    bhit(bk, b);
+    b->refcnt++;
+    goto out;
+  }
+  if((b = bvictim(bk)) != 0){
+    bassign(bk, b, dev, blockno);
+    bmiss(bk, b, prefetch);
+    goto out;
+  }
+
+  for(i = 1; i < NBUCKET; i++){
+    victimbk = &bcache.bucket[(h + i) % NBUCKET];
+    acquire(&victimbk->lock);
+    if((b = bvictim(victimbk)) != 0){
+      bunlink(b);
+      release(&victimbk->lock);
+      bpushtail(bk, b);
+      bassign(bk, b, dev, blockno);
+      bmiss(bk, b, prefetch);
+      goto out;
     }
+    release(&victimbk->lock);
   }
-  panic("bget: no buffers");
+  if(!prefetch)
+    panic("bget: no buffers");
+
+out:
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(b)
+    acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -92,7 +504,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -100,6 +512,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it, for a caller that will overwrite all of it before
+// releasing it.
+struct buf*
+bgetblk(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -109,43 +534,316 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Unlock b and drop a reference to it.
+// use is 0 if b was only read ahead.
+static void
+bput(struct buf *b, int use)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[b->bucket];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    bplace(bk, b, use);
+  }
+  release(&bk->lock);
+}
+
+// Queue reads (write == 0) or writes of the n locked buffers
+// b[], without waiting for the disk.  Buffers that hold
+// consecutive blocks go to the disk as one request of up to
+// MAXIOBLOCKS blocks.  Requests queued this way go to the disk
+// together at the next bwait() or bkick().
+void
+bsubmit(struct buf **b, int n, int write)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    if(!holdingsleep(&b[i]->lock))
+      panic("bsubmit");
+    for(j = i + 1; j < n && j - i < MAXIOBLOCKS; j++){
+      if(b[j]->dev != b[i]->dev || b[j]->blockno != b[i]->blockno + (j - i))
+        break;
+      if(!holdingsleep(&b[j]->lock))
+        panic("bsubmit");
+    }
+    virtio_disk_submit(b + i, j - i, write);
+  }
+}
+
+// Wait for the request bsubmit() queued for b to finish.
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+  b->valid = 1;
+}
+
+// Start the disk on requests queued by bsubmit() or bprefetch().
+void
+bkick(void)
+{
+  virtio_disk_kick();
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the MRU end of one of its bucket's lists.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  releasesleep(&b->lock);
+  bput(b, 1);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Called from virtio_disk_intr() when a read-ahead finishes.
+// The buffer was locked by bprefetch(); unlock it on its behalf.
+static void
+bprefetchdone(struct buf *b)
+{
+  b->iodone = 0;
+  b->valid = 1;
+  bput(b, 0);
+}
+
+// Queue reads of blocks blockno .. blockno+n-1 into the cache,
+// without waiting for the disk; call bkick() after queueing a
+// batch.  Runs of blocks that aren't cached go to the disk as
+// single requests.  Skips blocks that are already cached or for
+// which no buffer is free.  Returns -1 if the disk queue is full,
+// so that callers can stop asking.
+int
+bprefetch(uint dev, uint blockno, int n)
+{
+  struct buf *b[MAXIOBLOCKS];
+  int i, j, m;
+
+  for(i = 0; i < n; i += m){
+    for(m = 0; i + m < n && m < MAXIOBLOCKS; m++){
+      if((b[m] = bget(dev, blockno + i + m, 1)) == 0)
+        break;
+      b[m]->iodone = bprefetchdone;
+      b[m]->filedata = 1;
+    }
+    if(m == 0){
+      m = 1;   // cached, or no free buffer; skip it
+      continue;
+    }
+    if(virtio_disk_trysubmit(b, m, 0) < 0){
+      for(j = 0; j < m; j++){
+        b[j]->iodone = 0;
+        bput(b[j], 0);
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Lock b, as bread() would, but return 0 rather than sleep
+// if someone else holds it.  b must be pinned.
+int
+btrylock(struct buf *b)
+{
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  if(!tryacquiresleep(&b->lock))
+    return 0;
+  acquire(&bk->lock);
+  b->refcnt++;
+  release(&bk->lock);
+  return 1;
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  if(b->npin++ == 0)
+    bk->stat.dirty++;
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt--;
+  if(--b->npin == 0)
+    bk->stat.dirty--;
+  release(&bk->lock);
+}
+
+// If no buffer in page group g is in use, unlink them all
+// from their buckets and return 1; otherwise return 0.
+// Caller must hold bcache.lock.
+static int
+bdetach(struct buf *g)
+{
+  struct bucket *held[PGSIZE/BSIZE];
+  struct buf *b;
+  int i, n, idle;
+
+  // Lock every bucket holding a member of the group.
+  n = 0;
+  b = g;
+  do {
+    for(i = 0; i < n; i++)
+      if(held[i] == &bcache.bucket[b->bucket])
+        break;
+    if(i == n){
+      held[n] = &bcache.bucket[b->bucket];
+      acquire(&held[n++]->lock);
+    }
+    b = b->sib;
+  } while(b != g);
+
+  idle = 1;
+  b = g;
+  do {
+    if(b->refcnt != 0)
+      idle = 0;
+    b = b->sib;
+  } while(b != g);
+
+  if(idle){
+    b = g;
+    do {
+      bunlink(b);
+      b = b->sib;
+    } while(b != g);
+  }
+
+  for(i = 0; i < n; i++)
+    release(&held[i]->lock);
+  return idle;
+}
+
+// Return the headers of detached page group g to the free
+// list, and return its data page.
+// Caller must hold bcache.lock.
+static void*
+bungroup(struct buf *g)
+{
+  struct buf *b, *next;
+  void *pa;
+
+  pa = g->data;   // the leader holds the start of the page
+  b = g;
+  do {
+    next = b->sib;
+    b->data = 0;
+    b->next = bcache.freehdr;
+    bcache.freehdr = b;
+    bcache.nfreehdr++;
+    b = next;
+  } while(b != g);
+  bcache.nbuf -= BPP;
+  return pa;
+}
+
+// Give the pages of up to BSHRINK idle page groups back to
+// kalloc(), without shrinking the cache below minbuf buffers.
+// Returns the number of pages freed.
+// Called by kalloc() when it has no free pages; must not sleep.
+int
+bshrink(void)
+{
+  struct buf **pg, *g;
+  void *pa[BSHRINK];
+  int i, n;
+
+  if(bcache.groups == 0)   // binit() hasn't run yet
+    return 0;
+
+  n = 0;
+  acquire(&bcache.lock);
+  pg = &bcache.groups;
+  while(*pg && n < BSHRINK && bcache.nbuf - BPP >= bcache.minbuf){
+    g = *pg;
+    if(!bdetach(g)){
+      pg = &g->gnext;
+      continue;
+    }
+    *pg = g->gnext;
+    pa[n++] = bungroup(g);
+  }
+  release(&bcache.lock);
+
+  for(i = 0; i < n; i++)
+    kfree(pa[i]);
+  return n;
+}
+
+// Switch the cache to size-byte blocks.  Called by fsinit(),
+// before anything else uses the cache, when the file system's
+// blocks aren't BSIZE bytes.
+void
+bsetsize(uint size)
+{
+  struct buf *g;
+  void *pa;
+
+  acquire(&bcache.lock);
+  while((g = bcache.groups) != 0){
+    if(!bdetach(g))
+      panic("bsetsize: busy");
+    bcache.groups = g->gnext;
+    pa = bungroup(g);
+    release(&bcache.lock);
+    kfree(pa);
+    acquire(&bcache.lock);
+  }
+  bsize = size;
   release(&bcache.lock);
+  bsetup();
 }
 
+// Copy the buffer cache's statistics to the user struct
+// bcachestat at the address given as the first argument.
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr;
+  struct bcachestat st;
+  struct bucket *bk;
+  struct buf *b;
 
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&st, 0, sizeof(st));
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    st.hit += bk->stat.hit;
+    st.miss += bk->stat.miss;
+    st.evict += bk->stat.evict;
+    st.ra += bk->stat.ra;
+    st.rahit += bk->stat.rahit;
+    st.dirty += bk->stat.dirty;
+    st.hot += bk->nhot;
+    for(b = bk->hot.next; b != &bk->hot; b = b->next)
+      if(b->refcnt)
+        st.pinned++;
+    for(b = bk->cold.next; b != &bk->cold; b = b->next)
+      if(b->refcnt)
+        st.pinned++;
+    release(&bk->lock);
+  }
+  acquire(&bcache.lock);
+  st.nbuf = bcache.nbuf;
+  st.maxbuf = bcache.maxbuf;
+  release(&bcache.lock);
+  if(either_copyout(1, addr, &st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
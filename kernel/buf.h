@@ -5,8 +5,21 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint bucket;      // index of the hash bucket holding this buf
+  int hot;          // on the bucket's hot list?
+  int filedata;     // hint: holds file contents, not metadata
+  int used;         // used since the block was read?
+  uint usetick;     // ticks at that first use
+  int readahead;    // read ahead, and not looked up since?
+  uint npin;        // bpin()s not yet undone by bunpin()
+  int ordered;      // file data the next commit must write
+  struct buf *onext; // next in the log's list of such data
+  struct buf *prev; // LRU list of its hash bucket
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *sib;  // ring of bufs sharing a data page
+  struct buf *gnext; // next page group (group leaders only)
+  struct buf *qnext; // next buf in the same disk request
+  void (*iodone)(struct buf*); // if set, called when async disk I/O finishes
+  uchar *data;      // bsize bytes in a kalloc()ed page
 };
 
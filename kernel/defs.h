@@ -12,10 +12,20 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetblk(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(void);
+int             bprefetch(uint, uint, int);
+void            bsubmit(struct buf**, int, int);
+void            bwait(struct buf*);
+void            bkick(void);
+int             btrylock(struct buf*);
+void            bsetsize(uint);
+void            bsetmin(int);
+extern uint     bsize;
 
 // console.c
 void            consoleinit(void);
@@ -33,12 +43,13 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             fileallocate(struct file*, uint, uint);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -50,9 +61,13 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeblocks(struct inode*, uint);
 void            itrunc(struct inode*);
+int             iallocate(struct inode*, uint, int);
+void            bfree_commit(int, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,11 +78,17 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+uint64          kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
+void            log_data(struct buf*);
+void            log_force(void);
+void            log_tick(void);
+int             log_opblocks(void);
+int             log_tid(void);
+void            begin_op(int);
 void            end_op(void);
 
 // pipe.c
@@ -104,6 +125,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(char*, void (*)(void));
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -119,6 +141,7 @@ uint64          sys_ntas(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -181,6 +204,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf **, int, int);
+int             virtio_disk_trysubmit(struct buf **, int, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
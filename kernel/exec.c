@@ -21,7 +21,7 @@ exec(char *path, char **argv)
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -4,5 +4,5 @@
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 #define O_EXTENT  0x800  // extent based file flag
-#define O_INLINE  0x1000 // in-inode file 
+#define O_INLINE  0x1000 // in-inode file (the default now) 
 
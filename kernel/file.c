@@ -76,7 +76,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    begin_op(MAXOPBLOCKS);
     iput(ff.ip);
     end_op();
   }
@@ -101,12 +101,40 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// After a read, prefetch a read-ahead window beyond f->off if
+// the read started where the previous one ended (seq).  The
+// window starts at 4 blocks, doubles with each sequential read up
+// to MAXREADAHEAD, and closes when a read is not sequential.
+// Caller must hold f->ip->lock.
+static void
+filereadahead(struct file *f, int seq)
+{
+  uint first, end;
+
+  if(!seq){
+    f->ra_win = 0;
+    f->ra_end = 0;
+    return;
+  }
+  if(f->ra_win == 0)
+    f->ra_win = 4;
+  else if(f->ra_win < MAXREADAHEAD)
+    f->ra_win *= 2;
+
+  first = f->off / bsize;
+  end = first + f->ra_win;
+  if(first < f->ra_end)
+    first = f->ra_end;
+  if(first < end)
+    f->ra_end = first + ireadahead(f->ip, first, end - first);
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, seq;
 
   if(f->readable == 0)
     return -1;
@@ -119,8 +147,11 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(f, 1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    seq = (f->off == f->ra_next);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    filereadahead(f, seq);
+    f->ra_next = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,6 +160,29 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// How many of n bytes can one FS call write to ip? Besides
+// the data, writeblocks() counts the i-node, indirect block,
+// and allocation blocks. 0 if those alone don't leave room
+// for a block of data, as with a deep extent tree and a
+// small log.
+static uint
+opbytes(struct inode *ip, uint n)
+{
+  int max = log_opblocks();
+  int fixed;
+
+  if(writeblocks(ip, n) <= max)
+    return n;
+  fixed = writeblocks(ip, 0);
+  if(fixed >= max)
+    return 0;
+  if(n > (max - fixed) * bsize)
+    n = (max - fixed) * bsize;
+  while(n > 0 && writeblocks(ip, n) > max)
+    n -= (n < bsize ? n : bsize);
+  return n;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -146,20 +200,17 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as much at a time as one FS call may reserve
+    // log space for.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+      int n1 = opbytes(f->ip, n - i);
 
-      begin_op();
+      if(n1 == 0)
+        break;    // the log is too small for any of it.
+      begin_op(writeblocks(f->ip, n1));
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -180,3 +231,31 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Give file f zeroed blocks for bytes off .. off+n-1, extending
+// it if need be. f must be an extent file.
+int
+fileallocate(struct file *f, uint off, uint n)
+{
+  int r;
+  uint nb;
+
+  if(f->writable == 0 || f->type != FD_INODE || off + n < off)
+    return -1;
+
+  // a run of blocks at a time, as many as one FS call may
+  // reserve log space for.
+  do {
+    if((nb = opbytes(f->ip, off + n) / bsize) == 0){
+      if(writeblocks(f->ip, bsize) > log_opblocks())
+        return -1;
+      nb = 1;
+    }
+    begin_op(writeblocks(f->ip, nb * bsize));
+    ilock(f->ip);
+    r = iallocate(f->ip, off + n, nb);
+    iunlock(f->ip);
+    end_op();
+  } while(r > 0);
+  return r;
+}
+
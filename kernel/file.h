@@ -7,6 +7,9 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE and FD_DEVICE
+  uint ra_next;      // FD_INODE: off at which a sequential read would start
+  uint ra_win;       // FD_INODE: read-ahead window, in blocks
+  uint ra_end;       // FD_INODE: blocks below this have been prefetched
   short major;       // FD_DEVICE
   short minor;       // FD_DEVICE
 };
@@ -29,7 +32,16 @@ struct inode {
   short nlink;
   uint size;
   //struct extent the_extents[NUM_EXTENTS];
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  // extent files: blocks mapped, and a copy of some of the
+  // extents, sorted, which bmap() searches before the tree.
+  // pointer files keep runs from their indirect blocks in
+  // ext[] the same way.
+  uint nblocks;
+  struct extent ext[NEXTCACHE];
+  int next;           // extents in ext[]
+  int extlast;        // ext[] index of the last hit
 };
 
 // map major device number to device functions.
@@ -26,14 +26,17 @@
 // only one device
 struct superblock sb; 
 
+static void bmapinit(void);
+static void imapinit(void);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / bsize);
+  memmove(sb, bp->data + SBOFF % bsize, sizeof(*sb));
   brelse(bp);
 }
 
@@ -42,64 +45,380 @@ void
 fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
-    panic("invalid file system");
+    panic("invalid file system (rebuild fs.img)");
+  if(sb.bsize == 0)
+    sb.bsize = BSIZE;
+  if(sb.bsize < BSIZE || sb.bsize > MAXBSIZE || sb.bsize > PGSIZE ||
+     (sb.bsize & (sb.bsize - 1)) != 0)
+    panic("fsinit: bad block size");
+  if(sb.bsize != bsize)
+    bsetsize(sb.bsize);
+  if(sb.ibmapstart == 0)
+    panic("fsinit: no inode map");
   initlog(dev, &sb);
+  bmapinit();
+  imapinit();
 }
 
-// Zero a block.
+// Zero a block. Not logged, since the block may hold file
+// data; a block that becomes metadata is logged by whoever
+// fills it in.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  bp = bgetblk(dev, bno);
+  memset(bp->data, 0, bsize);
+  log_data(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// An in-memory summary of the free-block bitmap: how many
+// blocks each bitmap block has free, counted the first time
+// balloc() reads it, so that balloc() can skip full bitmap
+// blocks. balloc() starts looking where the last allocation
+// left off, and tests a 64-bit word of the bitmap at a time.
+// nfree[i] changes only while bitmap block i is locked.
+//
+// A block freed by a transaction that hasn't committed yet
+// mustn't be reused: the new owner's data would be written
+// home before the commit, and a crash would leave the old
+// file pointing at it. So, as in ext3, bfree_range() also sets
+// the freed blocks' bits in busy[i][tid%2], a page-sized mask
+// of bitmap block i, and balloc() treats them as in use until
+// bfree_commit(tid) drops the mask. Only the running and the
+// committing transaction can have one. busy[i] changes only
+// while bitmap block i is locked.
+struct {
+  struct spinlock lock;
+  int nbmap;              // bitmap blocks
+  int nfree[MAXBMAP];     // free blocks per bitmap block, or -1
+  uint64 *busy[MAXBMAP][2]; // freed by an uncommitted transaction
+  uint cursor;            // where the next search starts
+} bmap_sum;
+
+static void
+bmapinit(void)
+{
+  int i;
+
+  initlock(&bmap_sum.lock, "bmap");
+  bmap_sum.nbmap = (sb.size + BPB(sb) - 1) / BPB(sb);
+  if(bmap_sum.nbmap > MAXBMAP)
+    panic("bmapinit: too many bitmap blocks");
+  for(i = 0; i < bmap_sum.nbmap; i++)
+    bmap_sum.nfree[i] = -1;
+  bmap_sum.cursor = sb.size - sb.nblocks;  // first data block
+}
+
+// Index of the lowest 1 bit of x, which isn't 0.
+static int
+ctz64(uint64 x)
+{
+  int n = 0;
+
+  if((x & 0xffffffff) == 0){ n += 32; x >>= 32; }
+  if((x & 0xffff) == 0){ n += 16; x >>= 16; }
+  if((x & 0xff) == 0){ n += 8; x >>= 8; }
+  if((x & 0xf) == 0){ n += 4; x >>= 4; }
+  if((x & 0x3) == 0){ n += 2; x >>= 2; }
+  if((x & 0x1) == 0){ n += 1; }
+  return n;
+}
+
+// Bits of bitmap block bn that stand for blocks of the disk.
+static int
+bmapbits(int bn)
+{
+  return min(BPB(sb), sb.size - bn*BPB(sb));
+}
+
+// The first bit equal to v at or after bit from, and below
+// bit end, in bitmap block data, or -1. Bits set in the masks
+// busy[0] and busy[1] (if busy and they aren't 0) count as 1.
+static int
+bmapfind_busy(uchar *data, uint64 **busy, int from, int end, int v)
+{
+  uint64 *w = (uint64*)data, x;
+  int i, b;
+
+  for(i = from / 64; i*64 < end; i++){
+    x = w[i];
+    if(busy && busy[0])
+      x |= busy[0][i];
+    if(busy && busy[1])
+      x |= busy[1][i];
+    if(!v)
+      x = ~x;
+    if(i == from / 64)
+      x &= ~0ULL << (from % 64);
+    if(x == 0)
+      continue;
+    b = i*64 + ctz64(x);
+    return b < end ? b : -1;
+  }
+  return -1;
+}
+
+static int
+bmapfind(uchar *data, int from, int end, int v)
+{
+  return bmapfind_busy(data, 0, from, end, v);
+}
+
+// Set bits from .. to-1 of bitmap block data to v, a word at
+// a time where possible.
+static void
+bmapset(uchar *data, int from, int to, int v)
+{
+  uint64 *w = (uint64*)data, m;
+  int i;
+
+  for(i = from / 64; i*64 < to; i++){
+    m = ~0ULL;
+    if(i == from / 64)
+      m &= ~0ULL << (from % 64);
+    if(to - i*64 < 64)
+      m &= (1ULL << (to - i*64)) - 1;
+    if(v)
+      w[i] |= m;
+    else
+      w[i] &= ~m;
+  }
+}
+
+// The number of 0 bits below bit end in bitmap block data.
+static int
+bmapcount(uchar *data, int end)
+{
+  uint64 *w = (uint64*)data, x;
+  int i, n;
+
+  n = 0;
+  for(i = 0; i*64 < end; i++){
+    x = ~w[i];
+    if(end - i*64 < 64)
+      x &= (1ULL << (end - i*64)) - 1;
+    for(; x; x &= x - 1)
+      n++;
+  }
+  return n;
+}
+
+// The number of free blocks, counting the bitmap blocks that
+// balloc() hasn't counted yet.
 static uint
-balloc(uint dev)
+bcount(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  int bn, nfree;
+  uint n;
+
+  n = 0;
+  for(bn = 0; bn < bmap_sum.nbmap; bn++){
+    acquire(&bmap_sum.lock);
+    nfree = bmap_sum.nfree[bn];
+    release(&bmap_sum.lock);
+    if(nfree < 0){
+      bp = bread(dev, sb.bmapstart + bn);
+      nfree = bmapcount(bp->data, bmapbits(bn));
+      acquire(&bmap_sum.lock);
+      bmap_sum.nfree[bn] = nfree;
+      release(&bmap_sum.lock);
+      brelse(bp);
+    }
+    n += nfree;
+  }
+  return n;
+}
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+// Allocate a run of up to want free blocks: the first run of
+// want blocks after the cursor, or else the longest run there
+// is (a run doesn't cross bitmap blocks). Sets *got to the
+// length of the run and returns its first block, or 0 if no
+// block is free. Doesn't zero the blocks.
+static uint
+balloc_try(uint dev, int want, int *got)
+{
+  int i, bn, from, b, e, nfree, best, bestbn, bestb;
+  uint start;
+  uint64 **busy;
+  struct buf *bp;
+
+  acquire(&bmap_sum.lock);
+  start = bmap_sum.cursor;
+  release(&bmap_sum.lock);
+  if(start >= sb.size)
+    start = 0;
+
+  for(;;){
+    best = bestbn = bestb = 0;
+    // visit the bitmap block holding the cursor a second
+    // time, for the blocks before the cursor.
+    for(i = 0; i <= bmap_sum.nbmap; i++){
+      bn = (start / BPB(sb) + i) % bmap_sum.nbmap;
+      from = (i == 0 ? start % BPB(sb) : 0);
+      acquire(&bmap_sum.lock);
+      nfree = bmap_sum.nfree[bn];
+      release(&bmap_sum.lock);
+      if(nfree == 0 || (nfree > 0 && nfree <= best))
+        continue;
+
+      bp = bread(dev, sb.bmapstart + bn);
+      if(nfree < 0){
+        nfree = bmapcount(bp->data, bmapbits(bn));
+        acquire(&bmap_sum.lock);
+        bmap_sum.nfree[bn] = nfree;
+        release(&bmap_sum.lock);
       }
+      // look at each free run in turn.
+      busy = bmap_sum.busy[bn];
+      for(b = from; (b = bmapfind_busy(bp->data, busy, b, bmapbits(bn), 0)) >= 0; b = e){
+        e = min(b + want, bmapbits(bn));
+        if((e = bmapfind_busy(bp->data, busy, b, e, 1)) < 0)
+          e = min(b + want, bmapbits(bn));
+        if(e - b == want)
+          goto found;
+        if(e - b > best){
+          best = e - b;
+          bestbn = bn;
+          bestb = b;
+        }
+      }
+      brelse(bp);
+    }
+    if(best == 0){
+      *got = 0;
+      return 0;
+    }
+
+    // take the longest run, if nobody took it meanwhile.
+    bn = bestbn;
+    b = bestb;
+    bp = bread(dev, sb.bmapstart + bn);
+    if((e = bmapfind_busy(bp->data, bmap_sum.busy[bn], b, b + best, 1)) < 0)
+      e = b + best;
+    if(e > b){
+      want = e - b;
+      goto found;
+    }
+    brelse(bp);
+  }
+
+found:
+  bmapset(bp->data, b, b + want, 1);  // Mark blocks in use.
+  log_write(bp);
+  acquire(&bmap_sum.lock);
+  bmap_sum.nfree[bn] -= want;
+  bmap_sum.cursor = bn*BPB(sb) + b + want;
+  release(&bmap_sum.lock);
+  brelse(bp);
+  *got = want;
+  return bn*BPB(sb) + b;
+}
+
+// Like balloc_try(), but there must be a free block.
+static uint
+balloc_range(uint dev, int want, int *got)
+{
+  uint b;
+
+  if((b = balloc_try(dev, want, got)) == 0)
+    panic("balloc: out of blocks");
+  return b;
+}
+
+// Allocate a zeroed disk block.
+static uint
+balloc(uint dev)
+{
+  uint b;
+  int got;
+
+  b = balloc_range(dev, 1, &got);
+  bzero(dev, b);
+  return b;
+}
+
+// Free disk blocks b .. b+n-1, reading and logging each
+// bitmap block they span once.
+static void
+bfree_range(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  int bn, from, to, t;
+
+  t = log_tid() % 2;
+  while(n > 0){
+    bn = b / BPB(sb);
+    from = b % BPB(sb);
+    to = min(from + n, BPB(sb));
+    bp = bread(dev, sb.bmapstart + bn);
+    if(bmapfind(bp->data, from, to, 0) >= 0)
+      panic("freeing free block");
+    if(bmap_sum.busy[bn][t] == 0){
+      if((bmap_sum.busy[bn][t] = kalloc()) == 0)
+        panic("bfree: no memory");
+      memset(bmap_sum.busy[bn][t], 0, PGSIZE);
     }
+    bmapset((uchar*)bmap_sum.busy[bn][t], from, to, 1);
+    bmapset(bp->data, from, to, 0);
+    log_write(bp);
+    acquire(&bmap_sum.lock);
+    if(bmap_sum.nfree[bn] >= 0)
+      bmap_sum.nfree[bn] += to - from;
+    release(&bmap_sum.lock);
+    brelse(bp);
+    b += to - from;
+    n -= to - from;
+  }
+}
+
+// Transaction tid has committed: the blocks it freed may be
+// reused. Called by the committer.
+void
+bfree_commit(int dev, int tid)
+{
+  struct buf *bp;
+  int bn, t;
+
+  t = tid % 2;
+  for(bn = 0; bn < bmap_sum.nbmap; bn++){
+    if(bmap_sum.busy[bn][t] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + bn);
+    kfree(bmap_sum.busy[bn][t]);
+    bmap_sum.busy[bn][t] = 0;
     brelse(bp);
   }
-  panic("balloc: out of blocks");
 }
 
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bfree_range(dev, b, 1);
+}
+
+// Free the blocks listed in a[0..n), skipping 0s, a run of
+// consecutive block numbers at a time.
+static void
+bfree_list(int dev, uint *a, int n)
+{
+  int i, j;
+
+  for(i = 0; i < n; i = j){
+    if(a[i] == 0){
+      j = i + 1;
+      continue;
+    }
+    for(j = i + 1; j < n && a[j] == a[j-1] + 1; j++)
+      ;
+    bfree_range(dev, a[i], j - i);
+  }
 }
 
 // Inodes.
@@ -124,7 +443,8 @@ bfree(int dev, uint b)
 // rest of the file system code.
 //
 // * Allocation: an inode is allocated if its type (on disk)
-//   is non-zero. ialloc() allocates, and iput() frees if
+//   is non-zero, and its bit in the free inode map is set.
+//   ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
@@ -188,32 +508,97 @@ iinit()
 }
 
 static struct inode* iget(uint dev, uint inum);
+static int itrim(struct inode*);
+static void extload(struct inode*);
+
+// The free inode map has a bit per inode, set while the
+// inode's type on disk is non-zero; ialloc() and iput()
+// change both in one transaction. ialloc() searches it from
+// a hint, or else from imap.cursor, just past the inode it
+// last allocated.
+struct {
+  struct spinlock lock;
+  uint cursor;
+} imap;
+
+static void
+imapinit(void)
+{
+  initlock(&imap.lock, "imap");
+  imap.cursor = 1;
+}
 
-// Allocate an inode on device dev.
+// Allocate an inode on device dev, at or after inode near if
+// that isn't 0 (a new file's directory, say, so that related
+// inodes share inode blocks).
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  int i, nmap, bn, from, b;
+  uint start, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  start = near;
+  if(start == 0){
+    acquire(&imap.lock);
+    start = imap.cursor;
+    release(&imap.lock);
+  }
+  if(start >= sb.ninodes)
+    start = 1;
+
+  // visit the map block holding start a second time, for
+  // the inodes before start.
+  nmap = (sb.ninodes + BPB(sb) - 1) / BPB(sb);
+  for(i = 0; i <= nmap; i++){
+    bn = (start / BPB(sb) + i) % nmap;
+    from = (i == 0 ? start % BPB(sb) : 0);
+    bp = bread(dev, sb.ibmapstart + bn);
+    b = bmapfind(bp->data, from, min(BPB(sb), sb.ninodes - bn*BPB(sb)), 0);
+    if(b < 0){
       brelse(bp);
-      return iget(dev, inum);
+      continue;
     }
+    bmapset(bp->data, b, b + 1, 1);
+    log_write(bp);
     brelse(bp);
+
+    inum = bn*BPB(sb) + b;
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB(sb);
+    if(dip->type != 0)
+      panic("ialloc: inode map");
+    memset(dip, 0, sizeof(*dip));
+    dip->type = type;
+    log_write(bp);   // mark it allocated on the disk
+    brelse(bp);
+    acquire(&imap.lock);
+    imap.cursor = inum + 1;
+    release(&imap.lock);
+    return iget(dev, inum);
   }
   panic("ialloc: no inodes");
 }
 
+// Mark inode inum free in the free inode map.
+static void
+ifree(uint dev, uint inum)
+{
+  struct buf *bp;
+  int b;
+
+  bp = bread(dev, IBBLOCK(inum, sb));
+  b = inum % BPB(sb);
+  if(bmapfind(bp->data, b, b + 1, 1) < 0)
+    panic("ifree");
+  bmapset(bp->data, b, b + 1, 0);
+  log_write(bp);
+  brelse(bp);
+}
+
 // Copy a modified in-memory inode to disk.
 // Must be called after every change to an ip->xxx field
 // that lives on disk, since i-node cache is write-through.
@@ -225,7 +610,7 @@ iupdate(struct inode *ip)
   struct dinode *dip;
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb);
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
@@ -298,7 +683,7 @@ ilock(struct inode *ip)
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
+    dip = (struct dinode*)bp->data + ip->inum%IPB(sb);
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
@@ -309,6 +694,9 @@ ilock(struct inode *ip)
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
+    ip->next = 0;
+    if(ip->type == T_EXTENT)
+      extload(ip);
   }
 }
 
@@ -346,10 +734,18 @@ iput(struct inode *ip)
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
+    acquire(&icache.lock);
+  } else if(ip->ref == 1 && ip->valid && ip->type == T_EXTENT){
+    // give back blocks preallocated past the end of the file.
+    acquiresleep(&ip->lock);
+    release(&icache.lock);
+    itrim(ip);
+    releasesleep(&ip->lock);
     acquire(&icache.lock);
   }
 
@@ -370,108 +766,506 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT
+// after them in the indirect blocks that block
+// ip->addrs[NDIRECT+1] lists. Extent files keep the
+// root of an extent tree in ip->addrs[] instead.
+
+// Extent files. The root of ip's extent tree is ip->addrs[],
+// which is all zeros in a new inode. Files only grow at the
+// end, so new extents always go in the last leaf, and a full
+// node gets a new right sibling rather than being split. When
+// the root fills, its entries move to a new block and the
+// root becomes an index node one level higher.
+//
+// The in-memory inode caches a window of up to NEXTCACHE
+// extents from one leaf, with the one last used, so most
+// bmap() calls find their block without reading the tree.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// The root of extent file ip's tree.
+static struct extent_header*
+extroot(struct inode *ip)
+{
+  struct extent_header *eh;
+
+  eh = (struct extent_header*)ip->addrs;
+  if(eh->magic == 0){
+    eh->magic = EXT_MAGIC;
+    eh->max = EXT_MAX(sizeof(ip->addrs), struct extent);
+  }
+  if(eh->magic != EXT_MAGIC)
+    panic("extroot");
+  return eh;
+}
+
+// The node in buffer bp.
+static struct extent_header*
+extnode(struct buf *bp)
+{
+  struct extent_header *eh;
+
+  eh = (struct extent_header*)bp->data;
+  if(eh->magic != EXT_MAGIC)
+    panic("extnode");
+  return eh;
+}
+
+// Index of the last entry of node eh whose first file block
+// is at most bn, or -1 if there is none.
+static int
+extsearch(struct extent_header *eh, uint bn)
+{
+  int lo, hi, mid;
+  uint lblk;
+
+  lo = 0;
+  hi = eh->nent;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(eh->depth == 0)
+      lblk = EXT_LEAF(eh)[mid].lblk;
+    else
+      lblk = EXT_IDX(eh)[mid].lblk;
+    if(lblk <= bn)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+// Cache the extents of leaf eh around its ith, which
+// bmap() just used; later blocks are likelier to be wanted.
+static void
+extfill(struct inode *ip, struct extent_header *eh, int i)
+{
+  int start;
+
+  start = i;
+  if(start > eh->nent - NEXTCACHE)
+    start = eh->nent - NEXTCACHE;
+  if(start < 0)
+    start = 0;
+  ip->next = min(eh->nent - start, NEXTCACHE);
+  memmove(ip->ext, EXT_LEAF(eh) + start, ip->next * sizeof(struct extent));
+  ip->extlast = i - start;
+}
+
+// Disk block holding block bn of extent file ip, if ip's
+// cached extents map it, else 0.
 static uint
-bmap(struct inode *ip, uint bn)
+extcached(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  struct extent *ex;
+  int lo, hi, mid;
+
+  if(ip->next == 0)
+    return 0;
+  ex = &ip->ext[ip->extlast];
+  if(bn - ex->lblk < ex->len)
+    return ex->pblk + (bn - ex->lblk);
+  lo = 0;
+  hi = ip->next;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(ip->ext[mid].lblk <= bn)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo == 0)
+    return 0;
+  ex = &ip->ext[lo-1];
+  if(bn - ex->lblk >= ex->len)
+    return 0;
+  ip->extlast = lo - 1;
+  return ex->pblk + (bn - ex->lblk);
+}
+
+// Disk block holding block bn of extent file ip, or 0 if
+// ip's extents don't reach bn.
+static uint
+extlookup(struct inode *ip, uint bn)
+{
+  struct extent_header *eh;
+  struct extent *ex;
   struct buf *bp;
-  
-  // extent based logic from here!
-  int i=0; // we define here since we later need to use i
-  uint current_bn = bn; 
-  if (ip->type == T_EXTENT){
-    // here we search through existing extents
-    for(i = 0; i < NDIRECT; i++){
-      uint entry = ip->addrs[i];
-      if(entry == 0) {
-        // if entry empty we go to allocation directly
-        break; 
-      }
-      // now for non-empty addr[], we extract information
-      uint ex_addr = EXTENT_ADDR(entry);
-      uint ex_len  = EXTENT_LEN(entry);
-      
-      // Is the required block inside the current extent?
-      if(current_bn < ex_len){
-        return ex_addr + current_bn;
-      }
-      // the block might be in the next extent 
-      current_bn -= ex_len;
+  uint addr;
+  int i;
+
+  if((addr = extcached(ip, bn)) != 0)
+    return addr;
+  eh = extroot(ip);
+  bp = 0;
+  while(eh->depth > 0){
+    if((i = extsearch(eh, bn)) < 0)
+      break;
+    addr = EXT_IDX(eh)[i].child;
+    if(bp)
+      brelse(bp);
+    bp = bread(ip->dev, addr);
+    eh = extnode(bp);
+  }
+  addr = 0;
+  if(eh->depth == 0 && (i = extsearch(eh, bn)) >= 0){
+    ex = &EXT_LEAF(eh)[i];
+    if(bn - ex->lblk < ex->len){
+      addr = ex->pblk + (bn - ex->lblk);
+      extfill(ip, eh, i);
     }
-    
-    // here we start allocation if we are unable to find in existing extents
-    // here handle if it execeeds limit
-    if(i == NDIRECT)
-      panic("extent-based bmap: file too large (out of extents)");
-
-    // here we allocate by calling balloc
-    addr = balloc(ip->dev);
-
-    if(addr == 0){
-      // disk full now 
-      return 0;} 
-    // here we consider the problem of merging 
-    int has_merged =0;
-    if(i>0){
-      uint prev_entry = ip->addrs[i-1];
-      uint prev_addr  = EXTENT_ADDR(prev_entry);
-      uint prev_len   = EXTENT_LEN(prev_entry);
-      if(prev_len < 255 && (prev_addr + prev_len) == addr){
-        // merge if last extent has length < 255
-        ip->addrs[i-1] = PACK_EXTENT(prev_addr, prev_len + 1);
-        has_merged = 1;
+  }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Set up the in-memory state of extent file ip, which
+// ilock() just read: the blocks it maps, which end with the
+// last extent in the last leaf, and that leaf's extents.
+static void
+extload(struct inode *ip)
+{
+  struct extent_header *eh;
+  struct extent *ex;
+  struct buf *bp;
+  uint addr;
+
+  eh = extroot(ip);
+  bp = 0;
+  while(eh->depth > 0 && eh->nent > 0){
+    addr = EXT_IDX(eh)[eh->nent-1].child;
+    if(bp)
+      brelse(bp);
+    bp = bread(ip->dev, addr);
+    eh = extnode(bp);
+  }
+  ip->nblocks = 0;
+  if(eh->depth == 0 && eh->nent > 0){
+    ex = &EXT_LEAF(eh)[eh->nent-1];
+    ip->nblocks = ex->lblk + ex->len;
+    extfill(ip, eh, eh->nent - 1);
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Note that extent e, just appended to ip's tree, maps ip's
+// next blocks. Extend the cache with it if the cache holds
+// ip's last extent, so that appending writes keep hitting
+// the cache; otherwise start the cache over with e.
+static void
+extcacheadd(struct inode *ip, struct extent *e)
+{
+  struct extent *last;
+
+  last = ip->next > 0 ? &ip->ext[ip->next-1] : 0;
+  if(last == 0 || last->lblk + last->len != e->lblk){
+    ip->ext[0] = *e;
+    ip->next = 1;
+    ip->extlast = 0;
+    return;
+  }
+  if(last->pblk + last->len == e->pblk){
+    last->len += e->len;
+    return;
+  }
+  if(ip->next == NEXTCACHE){
+    memmove(ip->ext, ip->ext + 1, (NEXTCACHE - 1) * sizeof(struct extent));
+    ip->next--;
+    if(ip->extlast > 0)
+      ip->extlast--;
+  }
+  ip->ext[ip->next++] = *e;
+}
+
+// A new node block at the given depth holding n entries
+// copied from ent.
+static uint
+extnew(struct inode *ip, int depth, void *ent, int n)
+{
+  struct extent_header *eh;
+  struct buf *bp;
+  uint addr;
+
+  addr = balloc(ip->dev);
+  bp = bread(ip->dev, addr);
+  eh = (struct extent_header*)bp->data;
+  eh->magic = EXT_MAGIC;
+  eh->nent = n;
+  eh->depth = depth;
+  if(depth == 0){
+    eh->max = EXT_MAX(bsize, struct extent);
+    memmove(EXT_LEAF(eh), ent, n * sizeof(struct extent));
+  } else {
+    eh->max = EXT_MAX(bsize, struct extent_idx);
+    memmove(EXT_IDX(eh), ent, n * sizeof(struct extent_idx));
+  }
+  log_write(bp);
+  brelse(bp);
+  return addr;
+}
+
+// Append extent e to the subtree under node eh, which is in
+// bp, or in the inode if bp is 0. If eh is full, returns a
+// new right sibling for eh's parent to take, else 0.
+static uint
+extinsert(struct inode *ip, struct extent_header *eh, struct buf *bp, struct extent *e)
+{
+  struct extent *last;
+  struct extent_idx idx;
+  struct buf *cbp;
+  uint child;
+
+  if(eh->depth == 0){
+    if(eh->nent > 0){
+      last = &EXT_LEAF(eh)[eh->nent-1];
+      if(last->pblk + last->len == e->pblk){
+        last->len += e->len;
+        goto out;
       }
     }
-    // here, it seems that we cannot merge, so create a new extent
-    if(!has_merged){
-      //printf("bmap: creating new extent at index %d, block %d\n", i, addr);
-      ip->addrs[i] = PACK_EXTENT(addr, 1);
-    }else{
-      //printf("bmap: merging extent at index %d, new len %d\n", i-1, EXTENT_LEN(ip->addrs[i-1]));
+    if(eh->nent == eh->max)
+      return extnew(ip, 0, e, 1);
+    EXT_LEAF(eh)[eh->nent++] = *e;
+    goto out;
+  }
+
+  cbp = bread(ip->dev, EXT_IDX(eh)[eh->nent-1].child);
+  child = extinsert(ip, extnode(cbp), cbp, e);
+  brelse(cbp);
+  if(child == 0)
+    return 0;
+  idx.lblk = e->lblk;
+  idx.child = child;
+  if(eh->nent == eh->max)
+    return extnew(ip, eh->depth, &idx, 1);
+  EXT_IDX(eh)[eh->nent++] = idx;
+
+out:
+  if(bp)
+    log_write(bp);
+  return 0;
+}
+
+// Add blocks addr .. addr+len-1 to the end of extent file ip.
+static void
+extappend(struct inode *ip, uint addr, uint len)
+{
+  struct extent_header *eh;
+  struct extent e;
+  struct extent_idx idx[2];
+  uint sib;
+
+  e.lblk = ip->nblocks;
+  e.pblk = addr;
+  e.len = len;
+  ip->nblocks += len;
+  extcacheadd(ip, &e);
+  eh = extroot(ip);
+  if((sib = extinsert(ip, eh, 0, &e)) == 0)
+    return;
+
+  // the root is full: move its entries down a level.
+  if(eh->depth == EXTMAXDEPTH)
+    panic("extappend: tree too deep");
+  idx[0].lblk = 0;
+  idx[0].child = extnew(ip, eh->depth, eh + 1, eh->nent);
+  idx[1].lblk = e.lblk;
+  idx[1].child = sib;
+  eh->depth++;
+  eh->nent = 2;
+  eh->max = EXT_MAX(sizeof(ip->addrs), struct extent_idx);
+  memmove(EXT_IDX(eh), idx, sizeof(idx));
+}
+
+// Free the blocks that the subtree under node eh (in bp, or
+// the inode if bp is 0) maps at or past file block keep, and
+// the nodes left empty. Returns the number of data blocks
+// freed.
+static int
+extfree(struct inode *ip, struct extent_header *eh, struct buf *bp, uint keep)
+{
+  struct extent *ex;
+  struct extent_idx *idx;
+  struct buf *cbp;
+  uint n;
+  int freed;
+
+  freed = 0;
+  while(eh->nent > 0){
+    if(eh->depth == 0){
+      ex = &EXT_LEAF(eh)[eh->nent-1];
+      if(ex->lblk + ex->len <= keep)
+        break;
+      n = keep > ex->lblk ? keep - ex->lblk : 0;   // blocks to keep
+      bfree_range(ip->dev, ex->pblk + n, ex->len - n);
+      freed += ex->len - n;
+      ex->len = n;
+      if(n > 0)
+        break;
+      eh->nent--;
+    } else {
+      idx = &EXT_IDX(eh)[eh->nent-1];
+      cbp = bread(ip->dev, idx->child);
+      freed += extfree(ip, extnode(cbp), cbp, keep);
+      brelse(cbp);
+      if(idx->lblk < keep)
+        break;
+      bfree(ip->dev, idx->child);
+      eh->nent--;
+    }
+  }
+  if(bp && freed)
+    log_write(bp);
+  return freed;
+}
+
+// Block i of indirect block ind, which maps file block fbn,
+// allocating it if need be (zeroed unless whole is set, as
+// for bmap()). Caches the runs of blocks that ind maps from i
+// on, so that the blocks after fbn don't need ind read again.
+static uint
+ientry(struct inode *ip, uint ind, uint i, uint fbn, int whole)
+{
+  struct buf *bp;
+  struct extent *ex;
+  uint *a, addr, j;
+  int got;
+
+  bp = bread(ip->dev, ind);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = balloc_range(ip->dev, 1, &got);
+    log_write(bp);
+    if(!whole)
+      bzero(ip->dev, addr);
+  }
+  ip->next = 0;
+  ip->extlast = 0;
+  for(j = i; j < NINDIRECT(sb) && a[j] != 0; j++){
+    ex = &ip->ext[ip->next > 0 ? ip->next-1 : 0];
+    if(ip->next > 0 && ex->pblk + ex->len == a[j]){
+      ex->len++;
+      continue;
     }
+    if(ip->next == NEXTCACHE)
+      break;
+    ex = &ip->ext[ip->next++];
+    ex->lblk = fbn + (j - i);
+    ex->pblk = a[j];
+    ex->len = 1;
+  }
+  brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one. New blocks
+// are zeroed, unless whole is set: the caller will overwrite
+// all of the block.
+static uint
+bmap(struct inode *ip, uint bn, int whole)
+{
+  uint addr, *a, off, fbn;
+  struct buf *bp;
+  int want, got;
+
+  off = bn * bsize;
+  if(ip->type == T_EXTENT){
+    if((addr = extlookup(ip, bn)) != 0){
+      // blocks preallocated past the end of the file
+      // aren't zeroed until they are used.
+      if(off >= ip->size && !whole)
+        bzero(ip->dev, addr);
+      return addr;
+    }
+    // bn should be the first block past the extents. allocate
+    // it, and speculatively more, as many as the file has
+    // already (up to MAXPREALLOC), in one run, for later
+    // appends; iput() gives back what isn't used.
+    if(bn != ip->nblocks)
+      panic("bmap: extent hole");
+    want = bn;
+    if(want < 1)
+      want = 1;
+    if(want > MAXPREALLOC)
+      want = MAXPREALLOC;
+    addr = balloc_range(ip->dev, want, &got);
+    extappend(ip, addr, got);
+    if(!whole)
+      bzero(ip->dev, addr);
     return addr;
   }
 
   // original pointer-based is here. 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      ip->addrs[bn] = addr = balloc_range(ip->dev, 1, &got);
+      if(!whole)
+        bzero(ip->dev, addr);
+    }
     return addr;
   }
+  if((addr = extcached(ip, bn)) != 0)
+    return addr;
+  fbn = bn;
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
+  if(bn < NINDIRECT(sb)){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
       ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+    return ientry(ip, addr, bn, fbn, whole);
+  }
+  bn -= NINDIRECT(sb);
+
+  if(bn < NDINDIRECT(sb)){
+    // Load the double-indirect block, then the indirect
+    // block it points to, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / NINDIRECT(sb)]) == 0){
+      a[bn / NINDIRECT(sb)] = addr = balloc(ip->dev);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    return ientry(ip, addr, bn % NINDIRECT(sb), fbn, whole);
   }
 
   panic("pointer based bmap: out of range");
 }
 
+// Does ip keep its content in ip->addrs? Inline files do,
+// and so do directories while they fit: a directory moves to
+// a block when it outgrows the inode, and never shrinks.
+static int
+iinline(struct inode *ip)
+{
+  return ip->type == T_INLINE ||
+         (ip->type == T_DIR && ip->size <= sizeof(ip->addrs));
+}
+
+// Does ip hold file data, whatever its layout? The buffer
+// cache keeps the blocks of everything else (directories) hot.
+static int
+iregular(struct inode *ip)
+{
+  return ip->type == T_FILE || ip->type == T_EXTENT || ip->type == T_INLINE;
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
+  struct buf *bp, *ibp;
   uint *a;
+  int i;
   // printf("DEBUG: itrunc called for inode %d, type %d\n", ip->inum, ip->type);
   // HANDLE IN_INODE file here
-  if(ip->type == T_INLINE) {
+  if(iinline(ip)) {
     memset(ip->addrs, 0, sizeof(ip->addrs)); 
     ip->size = 0;
     iupdate(ip);
@@ -480,45 +1274,106 @@ itrunc(struct inode *ip)
   // end of in-inode file
 
   if(ip->type == T_EXTENT){
-    // extent-based file 
-    for(i = 0; i < NDIRECT; i++){
-      if(ip->addrs[i]){
-        uint addr = EXTENT_ADDR(ip->addrs[i]);
-        uint len  = EXTENT_LEN(ip->addrs[i]);
-        
-        // Free every block in the range
-        for(j = 0; j < len; j++){
-          bfree(ip->dev, addr + j);
-        }
-        ip->addrs[i] = 0;
-      }
-    }
+    extfree(ip, extroot(ip), 0, 0);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->nblocks = 0;
+    ip->next = 0;
   }
   else{
     // original point based here
-    for(i = 0; i < NDIRECT; i++){
-      if(ip->addrs[i]){
-        bfree(ip->dev, ip->addrs[i]);
-        ip->addrs[i] = 0;
-      }
-    }
-
     if(ip->addrs[NDIRECT]){
       bp = bread(ip->dev, ip->addrs[NDIRECT]);
+      bfree_list(ip->dev, (uint*)bp->data, NINDIRECT(sb));
+      brelse(bp);
+    }
+    if(ip->addrs[NDIRECT+1]){
+      bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
       a = (uint*)bp->data;
-      for(j = 0; j < NINDIRECT; j++){
-        if(a[j])
-          bfree(ip->dev, a[j]);
+      for(i = 0; i < NINDIRECT(sb); i++){
+        if(a[i]){
+          ibp = bread(ip->dev, a[i]);
+          bfree_list(ip->dev, (uint*)ibp->data, NINDIRECT(sb));
+          brelse(ibp);
+        }
       }
+      bfree_list(ip->dev, a, NINDIRECT(sb));
       brelse(bp);
-      bfree(ip->dev, ip->addrs[NDIRECT]);
-      ip->addrs[NDIRECT] = 0;
     }
+    // the direct blocks and the indirect blocks.
+    bfree_list(ip->dev, ip->addrs, NDIRECT+2);
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->next = 0;
+    // an empty file fits in the inode again.
+    if(ip->type == T_FILE)
+      ip->type = T_INLINE;
   }
   ip->size = 0;
   iupdate(ip);
 }
 
+// Free the blocks of extent file ip past the end of the file,
+// which appending writes preallocated. Returns the number of
+// blocks freed.
+// Caller must hold ip->lock.
+static int
+itrim(struct inode *ip)
+{
+  struct extent_header *eh;
+  uint keep;
+  int freed;
+
+  eh = extroot(ip);
+  keep = (ip->size + bsize - 1) / bsize;
+  freed = extfree(ip, eh, 0, keep);
+  if(eh->nent == 0)
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+  if(ip->nblocks > keep){
+    ip->nblocks = keep;
+    ip->next = 0;
+  }
+  if(freed)
+    iupdate(ip);
+  return freed;
+}
+
+// Give extent file ip zeroed blocks up to byte offset end,
+// allocating runs of up to n blocks at a time, and extend
+// ip->size over the blocks mapped. Returns the number of blocks
+// mapped, which is 0 once ip reaches end, or -1 if ip isn't an
+// extent file or the disk hasn't room for the blocks up to end.
+// Caller must hold ip->lock, and be in a transaction that
+// can log n blocks (see writeblocks()).
+int
+iallocate(struct inode *ip, uint end, int n)
+{
+  uint bn, addr, want;
+  int m, got;
+
+  if(ip->type != T_EXTENT)
+    return -1;
+  // check the whole range up front, rather than fail halfway;
+  // the tree may need a block per level too.
+  want = end / bsize + (end % bsize != 0);
+  if(want > ip->nblocks && want - ip->nblocks + EXTMAXDEPTH > bcount(ip->dev))
+    return -1;
+  bn = (ip->size + bsize - 1) / bsize;
+  for(m = 0; m < n && bn*bsize < end; m++, bn++){
+    if(bn == ip->nblocks){
+      // allocate what's left in one run if possible.
+      addr = balloc_try(ip->dev, min(n - m, (end - bn*bsize + bsize - 1) / bsize), &got);
+      if(addr == 0)
+        return -1;  // blocks freed by an uncommitted transaction.
+      extappend(ip, addr, got);
+    }
+    bmap(ip, bn, 0);   // zeroes the block
+  }
+  if(ip->size < min(end, bn*bsize)){
+    ip->size = min(end, bn*bsize);
+    iupdate(ip);
+  }
+  return m;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -557,7 +1412,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   // for In-inode file, we don't need to read from the disk !
-  if(ip->type == T_INLINE) {
+  if(iinline(ip)) {
     // data in array is stored continuously 
     char *inline_data = (char*)ip->addrs;
     if(either_copyout(user_dst, dst, inline_data + off, n) == -1)
@@ -566,10 +1421,15 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   }
   // stop here
 
+  // ask for all the blocks at once rather than one at a time.
+  if(n > 0 && off/bsize != (off + n - 1)/bsize)
+    ireadahead(ip, off/bsize, (off + n - 1)/bsize - off/bsize + 1);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    bp = bread(ip->dev, bmap(ip, off/bsize, 0));
+    bp->filedata = iregular(ip);
+    m = min(n - tot, bsize - off%bsize);
+    if(either_copyout(user_dst, dst, bp->data + (off % bsize), m) == -1) {
       brelse(bp);
       tot = -1;
       break;
@@ -579,6 +1439,86 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading blocks bn .. bn+n-1 of ip into the buffer cache,
+// without waiting for them, stopping at the end of the file.
+// Blocks that are adjacent on disk are read with one request.
+// Returns the number of blocks dealt with, which is less than n
+// if the disk queue filled up.
+// Caller must hold ip->lock.
+int
+ireadahead(struct inode *ip, uint bn, uint n)
+{
+  uint i, nblocks, addr, start, len;
+
+  if(iinline(ip) || ip->type == T_DEVICE)
+    return n;
+
+  nblocks = (ip->size + bsize - 1) / bsize;
+  start = len = 0;
+  for(i = 0; i < n && bn + i < nblocks; i++){
+    // blocks below ip->size are always mapped, so bmap()
+    // won't allocate (which would need a transaction).
+    if((addr = bmap(ip, bn + i, 0)) == 0)
+      break;
+    if(len > 0 && addr == start + len && len < MAXIOBLOCKS){
+      len++;
+      continue;
+    }
+    if(len > 0 && bprefetch(ip->dev, start, len) < 0){
+      i -= len;
+      len = 0;
+      break;
+    }
+    start = addr;
+    len = 1;
+  }
+  if(len > 0 && bprefetch(ip->dev, start, len) < 0)
+    i -= len;
+  bkick();
+  if(i == n || bn + i >= nblocks)
+    return n;
+  return i;
+}
+
+// Log bp, a block of ip's content: file data in ordered
+// mode, directory blocks in the log itself.
+static void
+ilog(struct inode *ip, struct buf *bp)
+{
+  if(ip->type == T_FILE || ip->type == T_EXTENT)
+    log_data(bp);
+  else
+    log_write(bp);
+}
+
+// Move the content of inline ip, which a write is about to
+// outgrow, to a block of its own, making an inline file a
+// pointer file. A directory takes the whole block, the rest
+// of it empty entries, so that it never looks inline again.
+// Caller must hold ip->lock, and be in a transaction.
+static void
+ipromote(struct inode *ip)
+{
+  char data[sizeof(ip->addrs)];
+  struct buf *bp;
+
+  memmove(data, ip->addrs, sizeof(data));
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  if(ip->type == T_INLINE)
+    ip->type = T_FILE;
+  ip->next = 0;
+  if(ip->size > 0 || ip->type == T_DIR){
+    bp = bgetblk(ip->dev, bmap(ip, 0, 1));
+    bp->filedata = iregular(ip);
+    memmove(bp->data, data, ip->size);
+    memset(bp->data + ip->size, 0, bsize - ip->size);
+    ilog(ip, bp);
+    brelse(bp);
+  }
+  if(ip->type == T_DIR)
+    ip->size = bsize;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -591,21 +1531,17 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int fresh;
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(ip->type != T_EXTENT && off + n > (uint64)MAXFILE(sb)*bsize)
     return -1;
 
   // === 2. HANDLE INLINE FILES ===
-  if(ip->type == T_INLINE) {
-   
-    uint max_inline_size = sizeof(ip->addrs); 
-
-    if(off + n > max_inline_size) {
-      // size check 
-        return -1; 
-    }
+  if(iinline(ip) && off + n > sizeof(ip->addrs))
+    ipromote(ip);
+  if(iinline(ip)) {
     char *inline_data = (char*)ip->addrs;
     if(either_copyin(inline_data + off, user_src, src, n) == -1)
       return -1;
@@ -620,14 +1556,30 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   }
   // stop here 
 
+  // fetch the existing blocks this write covers all at once.
+  if(n > 0 && off/bsize != (off + n - 1)/bsize)
+    ireadahead(ip, off/bsize, (off + n - 1)/bsize - off/bsize + 1);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+    m = min(n - tot, bsize - off%bsize);
+    // a block past the end of the file that this write fills
+    // needn't be zeroed or read first.
+    fresh = (m == bsize && off >= ip->size);
+    if(fresh)
+      bp = bgetblk(ip->dev, bmap(ip, off/bsize, 1));
+    else
+      bp = bread(ip->dev, bmap(ip, off/bsize, 0));
+    bp->filedata = iregular(ip);
+    if(either_copyin(bp->data + (off % bsize), user_src, src, m) == -1) {
+      if(fresh){
+        // the block is mapped now, so it must read as zeros.
+        memset(bp->data, 0, bsize);
+        ilog(ip, bp);
+      }
       brelse(bp);
       break;
     }
-    log_write(bp);
+    ilog(ip, bp);
     brelse(bp);
   }
 
@@ -642,6 +1594,29 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// How many blocks may writei() of n bytes to ip log?
+// The data blocks, with slop for a write that isn't
+// block-aligned, the i-node, the bitmap blocks that track
+// new blocks, and the indirect blocks: the indirect block,
+// the double-indirect block and the indirect blocks under it
+// that the data spans. For an extent file, instead, the tree
+// nodes that an append changes or adds: the path to the
+// last leaf and a new node at each level. Doesn't need
+// ip->lock, since ip's type can't change to or from
+// T_EXTENT; the tree may gain a level before the caller
+// locks ip, so count one more.
+int
+writeblocks(struct inode *ip, uint n)
+{
+  int nb, depth;
+
+  nb = n / bsize + 2;
+  if(ip->type != T_EXTENT)
+    return nb + 1 + nb / BPB(sb) + 2 + 2 + nb / NINDIRECT(sb) + 1;
+  depth = ((struct extent_header*)ip->addrs)->depth + 1;
+  return nb + 1 + nb / BPB(sb) + 2 + 2*depth + 2;
+}
+
 // Directories
 
 int
@@ -3,11 +3,16 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#define BSIZE 1024  // default and smallest block size
+#define MAXBSIZE 4096  // largest block size
+#define SBOFF 1024  // byte offset of the super block on disk
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                    free inode map | free bit map | data blocks]
+//
+// The super block is at byte SBOFF whatever the block size, so with
+// blocks bigger than SBOFF it shares block 0 with the boot block.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,14 +25,20 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes); 0 means BSIZE
+  uint ibmapstart;   // Block number of first free inode map block
 };
 
-#define FSMAGIC 0x10203040
+// Changes with the on-disk format. 0x10203041: small directories
+// live in the inode, which images made before can't tell apart
+// from directories with one block.
+#define FSMAGIC 0x10203041
 
-#define NDIRECT 12
+#define NDIRECT 11
 
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NINDIRECT(sb) ((sb).bsize / sizeof(uint))
+#define NDINDIRECT(sb) (NINDIRECT(sb) * NINDIRECT(sb))
+#define MAXFILE(sb) (NDIRECT + NINDIRECT(sb) + NDINDIRECT(sb))
 
 
 // On-disk inode structure
@@ -37,21 +48,24 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
  
 // Inodes per block.
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define IPB(sb)       ((sb).bsize / sizeof(struct dinode))
 
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     ((i) / IPB(sb) + (sb).inodestart)
 
 // Bitmap bits per block
-#define BPB           (BSIZE*8)
+#define BPB(sb)       ((sb).bsize*8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) ((b)/BPB(sb) + (sb).bmapstart)
+
+// Block of free inode map containing bit for inode i
+#define IBBLOCK(i, sb) ((i)/BPB(sb) + (sb).ibmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -61,14 +75,32 @@ struct dirent {
   char name[DIRSIZ];
 };
 
-// help function for extent-based file system
-
-#define ADDR_MASK  0xFFFFFF00 
-#define LEN_MASK   0x000000FF 
+// Extent files (T_EXTENT) map their blocks with a tree of
+// extents, as in ext4. The root node is the inode's addrs[];
+// the other nodes take a block each. A node is a header and
+// then entries sorted by first file block: extents in a leaf
+// (depth 0), index entries pointing a level down otherwise.
+struct extent_header {
+  ushort magic;   // EXT_MAGIC
+  ushort nent;    // entries in use
+  ushort max;     // entries that fit
+  ushort depth;   // levels below this node
+};
 
-#define EXTENT_ADDR(x)  ((x) >> 8)
+struct extent {
+  uint lblk;      // first file block
+  uint pblk;      // first disk block
+  uint len;       // number of blocks
+};
 
-#define EXTENT_LEN(x)   ((x) & LEN_MASK)
+struct extent_idx {
+  uint lblk;      // first file block under child
+  uint child;     // disk block of child node
+};
 
-#define PACK_EXTENT(addr, len)  (((addr) << 8) | ((len) & LEN_MASK))
+#define EXT_MAGIC 0xF30A
 
+// Entries of node eh, and how many of type t fit in n bytes.
+#define EXT_LEAF(eh)  ((struct extent*)((eh) + 1))
+#define EXT_IDX(eh)   ((struct extent_idx*)((eh) + 1))
+#define EXT_MAX(n, t) (((n) - sizeof(struct extent_header)) / sizeof(t))
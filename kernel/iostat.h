@@ -0,0 +1,32 @@
+// Disk and buffer cache statistics.
+// Both the kernel and user programs use this header file.
+
+#define NLATBIN 16  // latency histogram bins
+
+// Returned by diskstat().
+struct diskstat {
+  uint64 nreq;      // requests queued
+  uint64 nblock;    // blocks read or written by those requests
+  uint64 nkick;     // doorbell (queue notify) writes
+  uint64 depthsum;  // sum of depth just after each request was queued
+  uint depth;       // requests in flight now
+  uint maxdepth;    // most requests ever in flight at once
+  // requests by time from queueing to completion: bin i counts
+  // those under 2^(i+1) microseconds (the last bin, the rest).
+  uint64 rlat[NLATBIN];  // reads
+  uint64 wlat[NLATBIN];  // writes
+};
+
+// Returned by bcachestat().
+struct bcachestat {
+  uint64 hit;       // lookups that found the block cached
+  uint64 miss;      // lookups that had to read the block
+  uint64 evict;     // cached blocks recycled to hold another
+  uint64 ra;        // blocks read ahead
+  uint64 rahit;     // hits on read-ahead blocks not yet used
+  uint nbuf;        // buffers in the cache
+  uint maxbuf;      // limit on nbuf
+  uint hot;         // buffers on the 2Q hot lists
+  uint dirty;       // buffers the log holds until they are written home
+  uint pinned;      // buffers in use or held by the log
+};
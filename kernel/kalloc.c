@@ -67,24 +67,34 @@ kfree(void *pa)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When out of pages, asks the buffer cache to give some back.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
-    kmem.nfree--;
-  }
-  release(&kmem.lock);
+  do {
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    }
+    release(&kmem.lock);
+  } while(r == 0 && bshrink() > 0);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
 
+// Number of free pages.  Unlocked, so only a hint.
+uint64
+kfreepages(void)
+{
+  return kmem.nfree;
+}
+
 uint64
 sys_nfree(void)
 {
@@ -6,134 +6,495 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. A kernel thread, the committer, commits the running
+// transaction once it has been open for COMMITTICKS, holds a
+// quarter of the log, or someone waits for it in fsync() or
+// sync() (or in every end_op(), if the kernel is built with
+// LOG_SYNC_COMMIT). It stops new calls from joining, waits
+// for the calls in progress to finish, and copies the
+// transaction's blocks into log buffers. From then
+// on new calls join the next transaction, while the committer
+// writes the frozen copy to the log. Thus there is never any
+// reasoning required about whether a commit might write an
+// uncommitted system call's updates to disk, and calls that
+// finish while a commit is being written are committed together
+// by the next one.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op(n) reserves log space for the
+// n blocks the call may write; usually it just adds them to
+// the space reserved by in-progress FS system calls and
+// returns. But if the log might run out, it sleeps until a
+// commit or the flusher frees up log space.
+// end_op() doesn't wait for the commit; log_force() does.
+//
+// A commit only writes the transaction to the log. The blocks
+// stay pinned in the buffer cache, and a kernel thread, the
+// flusher, later writes them to their home locations (the
+// checkpoint) and then reclaims their log space. Until then,
+// later transactions that modify the same blocks just change
+// the cached copy, so a hot block is written home once per
+// checkpoint rather than once per transaction.
+//
+// File data isn't logged unless the kernel is built with
+// LOG_JOURNAL_DATA. Instead, as in ext3's ordered mode,
+// log_data() pins the block, and the commit writes it to its
+// home location before the header, so a committed inode never
+// points at blocks whose contents didn't reach the disk.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   header copy 0, containing block #s for block A, B, C, ...
+//   header copy 1
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The header lists every committed but not yet checkpointed
+// block; the same block # may appear more than once, and the
+// last copy wins. The log's size comes from the superblock;
+// each header copy takes as many blocks as it needs to list an
+// entry for each of the remaining blocks.
+//
+// A commit writes its log blocks and a new header together,
+// without waiting for one before the other. The header has a
+// sequence number and a checksum of itself and the log blocks
+// it lists; commits alternate between the two copies, so a
+// torn commit leaves the previous header intact, and recovery
+// uses the valid header with the highest sequence number.
+// After a checkpoint, or recovery, the next commit writes log
+// blocks from the start again, and an older header that lists
+// a prefix of the new ones could still pass its checksum if
+// that commit tore; replaying it would put old blocks over
+// checkpointed ones. So both write an empty header with the
+// next sequence number first, which outranks either copy.
 
-// Contents of the header block, used for both the on-disk header block
+// Contents of the header, used for both the on-disk header blocks
 // and to keep track in memory of logged block# before commit.
+// On disk, its first bsize bytes are the first header block,
+// and so on.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;        // sequence number; 0 if never written.
+  uint cksum;      // of log blocks, block[0..n), n, and seq.
+  int block[LOGMAX];
 };
 
+#define CKSEED 2166136261U // initial checksum
+// most blocks in a header copy.
+#define NHEADMAX ((sizeof(struct logheader) + BSIZE - 1) / BSIZE)
+
+#define LOGHASH 256   // buckets in the block # to entry index
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int nhead;       // blocks in each header copy.
+  int nent;        // entries that fit after the headers.
+  int maxop;       // blocks an FS call may reserve.
+  int reserved;    // blocks reserved by outstanding FS calls.
+  uint seq;        // sequence number of the last header written.
+  uint cksum;      // checksum of the committed log blocks.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // committer is waiting for them; please wait.
   int dev;
+  // lh.block[0..committed) are committed, [committed..running)
+  // are being committed, and [running..lh.n) are running.
+  int committed;
+  int running;
+  int tid;         // id of the running transaction.
+  int done;        // id of the last committed transaction.
+  int waiting;     // requests to commit the running transaction.
+  uint opentick;   // ticks when the running transaction logged a block.
+  int flushwant;   // the flusher should checkpoint.
+  int ready;       // initlog() is done; log_tick() may run.
+  struct buf *data; // running transaction's file data, through onext.
+  int ndata;       // blocks in the data list.
+  struct sleeplock hlock; // serializes header writes and reclaims.
+  struct buf *buf[LOGMAX]; // pinned buffer of each lh.block[].
   struct logheader lh;
+  // lh.block[] index: hhead[] and hnext[] chain the latest
+  // entry for each block # logged, or are -1.
+  int hhead[LOGHASH];
+  int hnext[LOGMAX];
+  struct buf *cbuf[LOGMAX+NHEADMAX]; // commit's log and header blocks.
+  struct buf *fbuf[LOGMAX]; // checkpoint's blocks.
+  struct buf *fbusy[LOGMAX];
+  struct buf *dbuf[LOGMAX]; // commit's file data blocks.
+  struct buf *dbusy[LOGMAX];
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit(void);
+static int head_size(int n);
+static void hrebuild(void);
+static void committer(void);
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   initlock(&log.lock, "log");
+  initsleeplock(&log.hlock, "loghead");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.tid = 1;
+
+  // a header copy needs room for an entry per log block.
+  for (log.nhead = 1; head_size(log.size - 2*log.nhead) > log.nhead * bsize; log.nhead++)
+    ;
+  log.nent = log.size - 2*log.nhead;
+  if (log.nent > LOGMAX || log.nent < MAXOPBLOCKS)
+    panic("initlog: bad log size");
+  log.maxop = log.nent / 2;
+  if (log.maxop < MAXOPBLOCKS)
+    log.maxop = MAXOPBLOCKS;
+  // every logged block stays pinned until checkpointed, file
+  // data until its commit, and a commit holds a log block for
+  // each logged block.
+  bsetmin(3*log.nent + log.maxop);
+
   recover_from_log();
+  kthread("committer", committer);
+  kthread("flusher", flusher);
+
+  acquire(&log.lock);
+  log.ready = 1;
+  release(&log.lock);
+}
+
+// The latest entry for block blockno, or -1.
+// Caller must hold log.lock, or be the only log user.
+static int
+hlookup(int blockno)
+{
+  int i;
+
+  for (i = log.hhead[blockno % LOGHASH]; i >= 0; i = log.hnext[i]) {
+    if (log.lh.block[i] == blockno)
+      return i;
+  }
+  return -1;
+}
+
+// Make entry i the latest one for its block.
+static void
+hinsert(int i)
+{
+  int *pp;
+
+  for (pp = &log.hhead[log.lh.block[i] % LOGHASH]; *pp >= 0; pp = &log.hnext[*pp]) {
+    if (log.lh.block[*pp] == log.lh.block[i]) {
+      log.hnext[i] = log.hnext[*pp];
+      *pp = i;
+      return;
+    }
+  }
+  log.hnext[i] = -1;
+  *pp = i;
+}
+
+// Index lh.block[0..lh.n) afresh, after entries have moved.
+static void
+hrebuild(void)
+{
+  int i;
+
+  for (i = 0; i < LOGHASH; i++)
+    log.hhead[i] = -1;
+  for (i = 0; i < log.lh.n; i++)
+    hinsert(i);
+}
+
+// How many blocks may one FS call reserve?
+int
+log_opblocks(void)
+{
+  return log.maxop;
+}
+
+// Disk block of log entry i.
+static int
+log_slot(int i)
+{
+  return log.start + 2*log.nhead + i;
+}
+
+// Checksum n bytes at p, continuing from c.
+static uint
+cksum(uint c, void *p, int n)
+{
+  uint *w = p;
+  int i;
+
+  for (i = 0; i < n / sizeof(uint); i++)
+    c = (c ^ w[i]) * 16777619;
+  return c;
+}
+
+// Checksum a header with entries block[0..n) and sequence
+// number seq, given the checksum c of its log blocks.
+static uint
+head_cksum(uint c, int *block, int n, uint seq)
+{
+  c = cksum(c, block, n * sizeof(int));
+  c = cksum(c, &n, sizeof(n));
+  return cksum(c, &seq, sizeof(seq));
 }
 
 // Copy committed blocks from log to their home location
+// after a crash. The writes are queued together and waited
+// for at the end.
 static void
 install_trans(void)
 {
-  int tail;
+  int tail, i, n;
+  struct buf **dbuf = log.cbuf, *lbuf;
 
+  n = 0;
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
+    lbuf = bread(log.dev, log_slot(tail)); // read log block
+    // keep dbuf[] sorted by block number, so that bsubmit()
+    // can merge adjacent blocks. a block logged more than
+    // once gets the last copy.
+    for (i = n; i > 0 && dbuf[i-1]->blockno > log.lh.block[tail]; i--)
+      ;
+    if (i == 0 || dbuf[i-1]->blockno != log.lh.block[tail]) {
+      memmove(&dbuf[i+1], &dbuf[i], (n - i) * sizeof(dbuf[0]));
+      dbuf[i] = bread(log.dev, log.lh.block[tail]); // read dst
+      n++;
+    } else {
+      i--;
+    }
+    memmove(dbuf[i]->data, lbuf->data, bsize);  // copy block to dst
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  bsubmit(dbuf, n, 1);  // write dst to disk
+  for (i = 0; i < n; i++) {
+    bwait(dbuf[i]);
+    brelse(dbuf[i]);
   }
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Bytes of a header with n entries.
+static int
+head_size(int n)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
+  return sizeof(struct logheader) - (LOGMAX - n) * sizeof(int);
+}
+
+// How many bytes of header block k hold a header with n
+// entries?
+static int
+head_bytes(int k, int n)
+{
+  int m = head_size(n) - k * bsize;
+
+  if (m > bsize)
+    m = bsize;
+  return m < 0 ? 0 : m;
+}
+
+// Read header copy c from disk into the in-memory log header.
+// Returns its sequence number if it is valid, or 0.
+static uint
+read_head(int c)
+{
+  struct buf *buf;
+  uint ck;
+  int k, i;
+
+  buf = bread(log.dev, log.start + c*log.nhead);
+  memmove(&log.lh, buf->data, head_bytes(0, 0));
+  brelse(buf);
+  if (log.lh.seq == 0 || log.lh.n < 0 || log.lh.n > log.nent)
+    return 0;
+  for (k = 0; head_bytes(k, log.lh.n) > 0; k++) {
+    buf = bread(log.dev, log.start + c*log.nhead + k);
+    memmove((char *) &log.lh + k*bsize, buf->data, head_bytes(k, log.lh.n));
+    brelse(buf);
+  }
+
+  // the log blocks aren't cached; ask for them all at once.
+  bprefetch(log.dev, log_slot(0), log.lh.n);
+  bkick();
+  ck = CKSEED;
   for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+    buf = bread(log.dev, log_slot(i));
+    ck = cksum(ck, buf->data, bsize);
+    brelse(buf);
   }
-  brelse(buf);
+  if (head_cksum(ck, log.lh.block, log.lh.n, log.lh.seq) != log.lh.cksum)
+    return 0;
+  return log.lh.seq;
+}
+
+// Fill locked buffers for a header with the first n entries
+// of the in-memory log header, given the checksum ck of their
+// log blocks, in the copy for sequence number seq.
+// Returns the number of buffers.
+// Caller must hold log.hlock.
+static int
+fill_head(struct buf **hb, int n, uint ck, uint seq)
+{
+  struct logheader *h;
+  int k;
+
+  for (k = 0; head_bytes(k, n) > 0; k++) {
+    hb[k] = bgetblk(log.dev, log.start + (seq % 2)*log.nhead + k);
+    memset(hb[k]->data, 0, bsize);
+    memmove(hb[k]->data, (char *) &log.lh + k*bsize, head_bytes(k, n));
+  }
+  h = (struct logheader *) hb[0]->data;
+  h->n = n;
+  h->seq = seq;
+  h->cksum = head_cksum(ck, log.lh.block, n, seq);
+  return k;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write an empty header with the next sequence number, so
+// that no header on disk lists any log block.
+// Caller must hold log.hlock, or be the only log user.
 static void
-write_head(void)
+clear_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  struct buf *hb[NHEADMAX];
+  int k, n;
+
+  log.seq++;
+  n = fill_head(hb, 0, CKSEED, log.seq);
+  bsubmit(hb, n, 1);
+  for (k = 0; k < n; k++) {
+    bwait(hb[k]);
+    brelse(hb[k]);
   }
-  bwrite(buf);
-  brelse(buf);
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
+  uint s0, s1;
+
+  s0 = read_head(0);
+  s1 = read_head(1);
+  if (s0 > s1)
+    read_head(0);
+  log.seq = s0 > s1 ? s0 : s1;
+  if (log.seq == 0)
+    log.lh.n = 0;
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.cksum = CKSEED;
+  hrebuild();
+  if (log.seq > 0)
+    clear_head();
+}
+
+// Has the running transaction logged anything?
+// Caller must hold log.lock.
+static int
+log_dirty(void)
+{
+  return log.lh.n > log.running || log.data;
+}
+
+// Ask the committer to commit the running transaction.
+// Caller must hold log.lock.
+static void
+log_commitwant(void)
+{
+  log.waiting++;
+  wakeup(&log.waiting);
+}
+
+// Wait until the updates of every FS call that has finished
+// are committed. Caller must hold log.lock.
+static void
+log_wait(void)
+{
+  int tid;
+
+  if(log_dirty()){
+    tid = log.tid;
+    log_commitwant();
+  } else {
+    tid = log.tid - 1;  // may still be being written.
+  }
+  while(log.done < tid)
+    sleep(&log.done, &log.lock);
+}
+
+// Make the updates of every FS call that has finished durable.
+// Used by fsync() and sync().
+void
+log_force(void)
+{
+  acquire(&log.lock);
+  log_wait();
+  release(&log.lock);
+}
+
+// The id of the running transaction, which a caller inside
+// begin_op()/end_op() belongs to.
+int
+log_tid(void)
+{
+  int tid;
+
+  acquire(&log.lock);
+  tid = log.tid;
+  release(&log.lock);
+  return tid;
+}
+
+// Called at every clock tick: commit a transaction that has
+// been open for COMMITTICKS. Does nothing until initlog() is
+// done.
+void
+log_tick(void)
+{
+  // the clock runs before the first process has called
+  // fsinit(); log.lock isn't even initialized then.
+  if(!log.ready)
+    return;
+  acquire(&log.lock);
+  if(log.waiting == 0 && log_dirty() && ticks - log.opentick >= COMMITTICKS)
+    log_commitwant();
+  release(&log.lock);
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call, which may
+// write up to n blocks.
 void
-begin_op(void)
+begin_op(int n)
 {
+  if(n < 1 || n > log.maxop)
+    panic("begin_op");
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.ndata + log.reserved + n > log.nent){
+      // this op might exhaust log space; wait for commit,
+      // or for the flusher to checkpoint.
+      if(log.committed > 0){
+        log.flushwant = 1;
+        wakeup(&log.flushwant);
+      }
+      if(log.waiting == 0 && log_dirty())
+        log_commitwant();
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -141,69 +502,296 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  log.reserved -= myproc()->logres;
+  // begin_op() may be waiting for log space,
+  // and decrementing log.reserved has decreased
+  // the amount of reserved space; the committer
+  // may be waiting for the last call to finish.
+  wakeup(&log);
+#ifdef LOG_SYNC_COMMIT
+  log_wait();
+#else
+  // commit before the transaction takes up too much of the log.
+  if(log.waiting == 0 && (log.lh.n - log.running) + log.ndata >= log.nent/4)
+    log_commitwant();
+#endif
+  release(&log.lock);
+}
+
+// Write the file data blocks on list d to their home locations
+// and unpin them. Like checkpoint(), never sleeps for one
+// buffer lock while holding another.
+static void
+write_data(struct buf *d)
+{
+  struct buf **b = log.dbuf, **busy = log.dbusy, *bp;
+  int i, n, nbusy;
+
+  // nothing changes d's onext links while it is marked ordered.
+  n = 0;
+  nbusy = 0;
+  for (; d; d = d->onext) {
+    if (!btrylock(d)) {
+      busy[nbusy++] = d;
+      continue;
+    }
+    // keep b[] sorted by block number, so that bsubmit()
+    // can merge adjacent blocks.
+    for (i = n; i > 0 && b[i-1]->blockno > d->blockno; i--)
+      ;
+    memmove(&b[i+1], &b[i], (n - i) * sizeof(b[0]));
+    b[i] = d;
+    n++;
+  }
+  for (i = 0; i < n; i++)
+    b[i]->ordered = 0;
+  bsubmit(b, n, 1);
+  for (i = 0; i < n; i++) {
+    bwait(b[i]);
+    bunpin(b[i]);
+    brelse(b[i]);
+  }
+  for (i = 0; i < nbusy; i++) {
+    bp = bread(log.dev, busy[i]->blockno);
+    bp->ordered = 0;
+    bwrite(bp);
+    bunpin(bp);
+    brelse(bp);
+  }
+}
+
+// Commit the running transaction, which no FS call is in.
+// New calls may join the next transaction once its blocks
+// have been copied to log buffers, before they are written.
+static void
+commit(void)
+{
+  struct buf **to = log.cbuf, *from, *data;
+  int tail, n, start, end, tid;
+
+  // the header write must not race with a checkpoint's reclaim,
+  // which moves log entries around.
+  acquiresleep(&log.hlock);
+
+  // no FS call can change lh.block[start..end) now.
+  acquire(&log.lock);
+  start = log.running;
+  end = log.lh.n;
+  tid = log.tid;
+  data = log.data;
+  log.data = 0;
+  log.ndata = 0;
+  release(&log.lock);
+
+  n = 0;
+  for (tail = start; tail < end; tail++) {
+    to[n] = bgetblk(log.dev, log_slot(tail)); // log block
+    from = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(to[n]->data, from->data, bsize);
+    brelse(from);
+    log.cksum = cksum(log.cksum, to[n]->data, bsize);
+    n++;
+  }
+
+  // let new calls start the next transaction.
+  acquire(&log.lock);
+  log.running = end;
+  log.tid++;
+  log.waiting = 0;
+  log.closing = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  // write the log and the header together; the commit
+  // happens once all of them are on disk. the file data
+  // must get there first.
+  if (data) {
+    bsubmit(to, n, 1);
+    write_data(data);
+    tail = n;
   } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    tail = 0;
+  }
+  if (n > 0 || data) {
+    log.seq++;
+    n += fill_head(to + n, end, log.cksum, log.seq);
+  }
+  bsubmit(to + tail, n - tail, 1);
+  for (tail = 0; tail < n; tail++) {
+    bwait(to[tail]);
+    brelse(to[tail]);
+  }
+  releasesleep(&log.hlock);
+  bfree_commit(log.dev, tid);
+
+  acquire(&log.lock);
+  log.committed = end;
+  log.done = tid;
+  wakeup(&log.done);
+  wakeup(&log);  // begin_op() may be waiting for log space.
+  // checkpoint before the log gets full.
+  if (log.committed >= log.nent/2) {
+    log.flushwant = 1;
+    wakeup(&log.flushwant);
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
+// The committer kernel thread: commits the running transaction
+// whenever asked to. Calls that finish while a commit is being
+// written are batched into the next one.
+static void
+committer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(log.waiting == 0)
+      sleep(&log.waiting, &log.lock);
+    // stop new calls from joining, and let the rest finish.
+    log.closing = 1;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    release(&log.lock);
     commit();
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
-static void
-write_log(void)
+// Has a transaction that isn't committed yet modified block
+// blockno?
+static int
+log_uncommitted(int blockno)
 {
-  int tail;
+  int r;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  acquire(&log.lock);
+  r = hlookup(blockno) >= log.committed;
+  release(&log.lock);
+  return r;
+}
+
+// Write the committed blocks to their home locations and
+// reclaim their log space. Skips a block that a transaction
+// not yet committed has modified, since its cached copy isn't
+// committed; returns -1 in that case, so the flusher can
+// try again after the next commit.
+static int
+checkpoint(void)
+{
+  struct buf **b = log.fbuf, **busy = log.fbusy, *bp;
+  int i, j, n, nb, nbusy, ok;
+
+  // the committed entries can't change until we reclaim them,
+  // but more may get committed meanwhile.
+  acquire(&log.lock);
+  n = log.committed;
+  nb = 0;
+  for (i = 0; i < n; i++) {
+    // sort by block number, so that bsubmit() can merge
+    // adjacent blocks; write each block once.
+    bp = log.buf[i];
+    for (j = nb; j > 0 && b[j-1]->blockno > bp->blockno; j--)
+      ;
+    if (j > 0 && b[j-1] == bp)
+      continue;
+    memmove(&b[j+1], &b[j], (nb - j) * sizeof(b[0]));
+    b[j] = bp;
+    nb++;
+  }
+  release(&log.lock);
+  if (n == 0)
+    return 0;
+
+  // write the blocks that nobody is using all together,
+  // without sleeping for buffer locks: an FS call may hold
+  // one buffer while it waits for another. the rest are
+  // written one at a time below.
+  ok = 1;
+  nbusy = 0;
+  for (i = 0, j = 0; i < nb; i++) {
+    if (!btrylock(b[i])) {
+      busy[nbusy++] = b[i];
+    } else if (log_uncommitted(b[i]->blockno)) {
+      brelse(b[i]);
+      ok = 0;
+    } else {
+      b[j++] = b[i];
+    }
+  }
+  bsubmit(b, j, 1);
+  for (i = 0; i < j; i++) {
+    bwait(b[i]);
+    brelse(b[i]);
+  }
+  for (i = 0; i < nbusy; i++) {
+    bp = bread(log.dev, busy[i]->blockno);
+    if (log_uncommitted(bp->blockno))
+      ok = 0;
+    else
+      bwrite(bp);
+    brelse(bp);
+  }
+  if (!ok)
+    return -1;
+
+  // reclaim the log space. if a commit got in meanwhile, its
+  // log blocks follow ours on disk, so try again later.
+  acquiresleep(&log.hlock);
+  acquire(&log.lock);
+  if (log.committed != n) {
+    release(&log.lock);
+    releasesleep(&log.hlock);
+    return -1;
+  }
+  for (i = 0; i < n; i++)
+    bunpin(log.buf[i]);
+  // the running transaction isn't in the log on disk yet,
+  // so its entries can simply move down. (no commit is
+  // in progress, since we hold log.hlock.)
+  for (i = n; i < log.lh.n; i++) {
+    log.lh.block[i-n] = log.lh.block[i];
+    log.buf[i-n] = log.buf[i];
   }
+  log.lh.n -= n;
+  log.running -= n;
+  log.committed = 0;
+  hrebuild();
+  release(&log.lock);
+  // the next commit writes the log blocks from the start.
+  log.cksum = CKSEED;
+  clear_head();
+  releasesleep(&log.hlock);
+
+  acquire(&log.lock);
+  wakeup(&log);  // begin_op() may be waiting for log space.
+  release(&log.lock);
+  return 0;
 }
 
+// The flusher kernel thread: checkpoints the log when it
+// is getting full.
 static void
-commit(void)
+flusher(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  acquire(&log.lock);
+  for(;;){
+    while(!log.flushwant)
+      sleep(&log.flushwant, &log.lock);
+    log.flushwant = 0;
+    release(&log.lock);
+    checkpoint();
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -216,21 +804,59 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.nent)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
+  if (!log_dirty())
+    log.opentick = ticks;
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
-  }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  // only the running transaction's entries can absorb b;
+  // older ones are already frozen in the log.
+  i = hlookup(b->blockno);
+  if (i < log.running) {  // Add new block to log?
+    i = log.lh.n;
+    log.lh.block[i] = b->blockno;
+    hinsert(i);
     bpin(b);
+    log.buf[i] = b;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Caller has modified file data in b and is done with the
+// buffer. Like log_write(), but unless the kernel is built
+// with LOG_JOURNAL_DATA the block isn't logged: it stays
+// pinned, and commit() writes it home before the header.
+void
+log_data(struct buf *b)
+{
+#ifdef LOG_JOURNAL_DATA
+  log_write(b);
+#else
+  acquire(&log.lock);
+  if (log.lh.n + log.ndata >= log.nent)
+    panic("too big a transaction");
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+  if (!log_dirty())
+    log.opentick = ticks;
 
+  // a block that is still in the log must stay there, or
+  // recovery would put the logged copy back over the data.
+  if (hlookup(b->blockno) >= 0) {
+    release(&log.lock);
+    log_write(b);
+    return;
+  }
+  if (!b->ordered) {
+    b->ordered = 1;
+    bpin(b);
+    b->onext = log.data;
+    log.data = b;
+    log.ndata++;
+  }
+  release(&log.lock);
+#endif
+}
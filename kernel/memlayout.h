@@ -29,6 +29,7 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define TIMEBASE_MHZ 10 // CLINT_MTIME cycles per microsecond in qemu
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -7,9 +7,19 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*3)  // default size of on-disk log
+#define LOGMAX       1024  // max blocks in on-disk log
+#define COMMITTICKS  10    // commit a transaction open this many ticks
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS)  // minimum size of disk block cache
+#define NBUFMAX      4096  // maximum size of disk block cache
+#define BCACHEFRAC   16    // block cache may use 1/BCACHEFRAC of free memory
+#define MAXREADAHEAD 32    // max read-ahead window, in blocks
+#define MAXIOBLOCKS  32    // max blocks in one disk request
 
 #define FSSIZE       2000  // size of file system in blocks
+#define MAXBMAP      256   // max bitmap blocks balloc() keeps free counts for
+#define MAXPREALLOC  64    // max blocks an appending write preallocates
+#define EXTMAXDEPTH  3     // max index levels in an extent tree
+#define NEXTCACHE    16    // extents an in-memory inode caches for bmap()
 
 #define MAXPATH      128   // maximum file path name
@@ -145,6 +145,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -221,6 +222,39 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch here.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(), which must not return.
+// It never goes to user space, so it has no user memory.
+// Must be called from process context, as initlog() is
+// during fsinit(), and after the log is set up, since fn()
+// may use the log and the buffer cache.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -334,7 +368,7 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   iput(p->cwd);
   end_op();
   p->cwd = 0;
@@ -104,4 +104,6 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint64 trap_va;              // trapframe va for threads
+  void (*kfn)(void);           // body of a kernel thread
+  int logres;                  // log blocks reserved by begin_op()
 };
@@ -30,16 +30,16 @@ ramdiskrw(struct buf *b)
   if(b->blockno >= FSSIZE)
     panic("ramdiskrw: blockno too big");
 
-  uint64 diskaddr = b->blockno * BSIZE;
+  uint64 diskaddr = b->blockno * bsize;
   char *addr = (char *)RAMDISK + diskaddr;
 
   if(b->flags & B_DIRTY){
     // write
-    memmove(addr, b->data, BSIZE);
+    memmove(addr, b->data, bsize);
     b->flags &= ~B_DIRTY;
   } else {
     // read
-    memmove(b->data, addr, BSIZE);
+    memmove(b->data, addr, bsize);
     b->flags |= B_VALID;
   }
 }
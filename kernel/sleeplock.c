@@ -30,6 +30,23 @@ acquiresleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Like acquiresleep(), but return 0 rather than
+// sleep if the lock is held.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
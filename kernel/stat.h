@@ -4,7 +4,7 @@
 #define T_EXTENT  4   // Extent-based File 
 #define T_INLINE  5   // in-inode file
 
-#define NDIRECT 12
+#define NDIRECT 11  // keep in step with fs.h
 
 struct stat {
   int dev;     // File system's disk device
@@ -13,5 +13,5 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
   // extent based 
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
@@ -106,6 +106,11 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_ntas(void);
 extern uint64 sys_nfree(void);
+extern uint64 sys_diskstat(void);
+extern uint64 sys_bcachestat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fallocate(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -131,6 +136,11 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_ntas]    sys_ntas,
 [SYS_nfree]   sys_nfree,
+[SYS_diskstat] sys_diskstat,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_fallocate] sys_fallocate,
 };
 
 void
@@ -24,3 +24,8 @@
 // System calls for labs
 #define SYS_ntas   22
 #define SYS_nfree  23
+#define SYS_diskstat 24
+#define SYS_bcachestat 25
+#define SYS_fsync  26
+#define SYS_sync   27
+#define SYS_fallocate 28
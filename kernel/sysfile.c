@@ -115,6 +115,42 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Give the file open as the first argument zeroed blocks for
+// len bytes at offset off, extending it if need be.
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  if(off < 0 || len < 0)
+    return -1;
+  return fileallocate(f, off, len);
+}
+
+// Commit the file system updates made so far, including those
+// to the file open as the first argument.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_force();
+  return 0;
+}
+
+// Commit the file system updates made so far.
+uint64
+sys_sync(void)
+{
+  log_force();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -125,7 +161,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +228,7 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -252,13 +288,14 @@ create(char *path, short type, short major, short minor)
   if((ip = dirlookup(dp, name, 0)) != 0){
     iunlockput(dp);
     ilock(ip);
-    if(type == T_FILE && (ip->type == T_FILE || ip->type == T_DEVICE || ip->type == T_EXTENT || ip->type == T_INLINE))
+    if((type == T_FILE || type == T_EXTENT || type == T_INLINE) &&
+       (ip->type == T_FILE || ip->type == T_DEVICE || ip->type == T_EXTENT || ip->type == T_INLINE))
       return ip;
     iunlockput(ip);
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -295,12 +332,12 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
 
   if(omode & O_CREATE){
-    int type = (omode & O_EXTENT) ? T_EXTENT :
-           (omode & O_INLINE) ? T_INLINE :
-                                T_FILE;
+    // new files start out inline, and writei() moves them
+    // to blocks when they outgrow the inode.
+    int type = (omode & O_EXTENT) ? T_EXTENT : T_INLINE;
 
     ip = create(path, type, 0, 0);
     if(ip == 0){
@@ -343,6 +380,9 @@ sys_open(void)
   }
   f->ip = ip;
   f->off = 0;
+  f->ra_next = 0;
+  f->ra_win = 0;
+  f->ra_end = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
@@ -362,7 +402,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -379,7 +419,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -399,7 +439,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
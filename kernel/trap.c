@@ -168,6 +168,7 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  log_tick();
 }
 
 // check if it's an external interrupt or software interrupt,
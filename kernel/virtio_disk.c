@@ -15,13 +15,15 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "iostat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and no more than the queue size
+// qemu offers (at least 128), or one page of descriptors.
+#define NUM 128
 
 struct disk {
   // The descriptor table tells the device where to read and write
@@ -46,12 +48,17 @@ struct disk {
   struct {
     struct buf *b;
     char status;
+    char write;
+    uint64 start;   // r_time() when queued
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
+
+  int unkicked;    // requests in avail ring the device hasn't been told of
+  struct diskstat stat;
+
   struct spinlock vdisk_lock;
 } disk;
 
@@ -181,10 +188,11 @@ free_chain(int i)
   }
 }
 
+// allocate n descriptors into idx[], or none of them.
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -195,28 +203,20 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Format the n+2 descriptors idx[] as one request to read or
+// write the n bufs b[], which must hold consecutive blocks, and
+// put it in the avail ring.  The device won't look at it until
+// virtio_disk_kick().
+// Caller must hold disk.vdisk_lock.
+static void
+virtio_disk_start(struct buf **b, int n, int write, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = b[0]->blockno * (bsize / 512);
+  int i;
 
-  acquire(&disk.vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-  
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
+  // the spec says that block operations use a descriptor for
+  // type/reserved/sector, then one per data segment, then one
+  // for a 1-byte status result.  qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
 
@@ -232,24 +232,32 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VIRTQ_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VIRTQ_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VIRTQ_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 0; i < n; i++){
+    if(b[i]->blockno != b[0]->blockno + i)
+      panic("virtio_disk_start: not contiguous");
+    disk.desc[idx[i+1]].addr = (uint64) b[i]->data;
+    disk.desc[idx[i+1]].len = bsize;
+    if(write)
+      disk.desc[idx[i+1]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i+1]].flags = VIRTQ_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i+1]].flags |= VIRTQ_DESC_F_NEXT;
+    disk.desc[idx[i+1]].next = idx[i+2];
+
+    // record struct bufs for virtio_disk_intr().
+    b[i]->disk = 1;
+    b[i]->qnext = (i + 1 < n) ? b[i+1] : 0;
+  }
 
   disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VIRTQ_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VIRTQ_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].b = b[0];
+  disk.info[idx[0]].write = write;
+  disk.info[idx[0]].start = r_time();
 
   // avail->idx tells the device how far to look in avail->ring.
   // avail->ring[...] are desc[] indices the device should process.
@@ -258,19 +266,131 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
   disk.avail->idx += 1;
 
+  disk.unkicked++;
+  disk.stat.nreq++;
+  disk.stat.nblock += n;
+  disk.stat.depth++;
+  disk.stat.depthsum += disk.stat.depth;
+  if(disk.stat.depth > disk.stat.maxdepth)
+    disk.stat.maxdepth = disk.stat.depth;
+}
+
+// Count a request that took t ticks of the time CSR in the
+// latency histograms.
+// Caller must hold disk.vdisk_lock.
+static void
+latency(int write, uint64 t)
+{
+  uint64 us = t / TIMEBASE_MHZ;
+  int i;
+
+  for(i = 0; i < NLATBIN-1 && us >= (2L << i); i++)
+    ;
+  if(write)
+    disk.stat.wlat[i]++;
+  else
+    disk.stat.rlat[i]++;
+}
+
+// Tell the device about requests added to the avail ring.
+// Caller must hold disk.vdisk_lock.
+static void
+kick(void)
+{
+  if(disk.unkicked == 0)
+    return;
+  __sync_synchronize();
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  disk.unkicked = 0;
+  disk.stat.nkick++;
+}
+
+// The asynchronous interface:
+// * virtio_disk_submit() and virtio_disk_trysubmit() queue one
+//   request to read or write n locked bufs holding consecutive
+//   blocks, but don't tell the device yet, so that many requests
+//   can be handed over with one doorbell.
+// * virtio_disk_kick() rings the doorbell.
+// * virtio_disk_wait() kicks and waits for one buf's request.
+// * alternatively, if b->iodone is set, virtio_disk_intr() calls
+//   it, with disk.vdisk_lock held, when b's request finishes.
+// virtio_disk_rw() does all of it for a single buf.
+
+// Queue a request to read or write b[0..n-1], sleeping until
+// the ring has room for it.
+void
+virtio_disk_submit(struct buf **b, int n, int write)
+{
+  int idx[MAXIOBLOCKS+2];
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_submit");
+
+  acquire(&disk.vdisk_lock);
+  while(1){
+    if(allocn_desc(idx, n+2) == 0) {
+      break;
+    }
+    // let the device work off what's queued so far.
+    kick();
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
+
+  virtio_disk_start(b, n, write, idx);
+
+  release(&disk.vdisk_lock);
+}
+
+// Like virtio_disk_submit(), but return -1 rather than
+// sleep if the ring is full.
+int
+virtio_disk_trysubmit(struct buf **b, int n, int write)
+{
+  int idx[MAXIOBLOCKS+2];
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_trysubmit");
+
+  acquire(&disk.vdisk_lock);
+  if(allocn_desc(idx, n+2) < 0){
+    release(&disk.vdisk_lock);
+    return -1;
+  }
+  virtio_disk_start(b, n, write, idx);
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
+  release(&disk.vdisk_lock);
+}
+
+// Wait for the request for b to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  kick();
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr(void)
 {
@@ -279,11 +399,26 @@ virtio_disk_intr(void)
   while((disk.used_idx % NUM) != (disk.used->idx % NUM)){
     int id = disk.used->ring[disk.used_idx].id;
 
+    struct buf *b = disk.info[id].b, *next;
+
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
-    
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+
+    disk.info[id].b = 0;
+    free_chain(id);
+    disk.stat.depth--;
+    latency(disk.info[id].write, r_time() - disk.info[id].start);
+
+    // the request covered b and the bufs chained from it.
+    for(; b; b = next){
+      next = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone)
+        b->iodone(b);
+      else
+        wakeup(b);
+    }
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
@@ -292,3 +427,20 @@ virtio_disk_intr(void)
   release(&disk.vdisk_lock);
 }
 
+// Copy the driver's statistics to the user struct diskstat
+// at the address given as the first argument.
+uint64
+sys_diskstat(void)
+{
+  uint64 addr;
+  struct diskstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  acquire(&disk.vdisk_lock);
+  st = disk.stat;
+  release(&disk.vdisk_lock);
+  if(either_copyout(1, addr, &st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
@@ -18,28 +18,36 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+// [ boot block | sb block | log | inode blocks | free inode map |
+//                                        free bit map | data blocks ]
+// The super block is at byte SBOFF, so with bsize > SBOFF it is in
+// the boot block.
+
+uint bsize = BSIZE;  // Block size
+int fssize;   // Size of file system in blocks
+int nsb;      // Number of blocks up to the end of the super block
+int nbitmap;
+int ninodeblocks;
+int nibitmap;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, inode map, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
 
 void balloc(int);
+void imap(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+int loghead(int nlog);
 
 // convert to intel byte order
 ushort
@@ -64,25 +72,71 @@ xint(uint x)
   return y;
 }
 
+void
+usage(void)
+{
+  fprintf(stderr, "Usage: mkfs [-b blocksize] [-l logblocks] fs.img files...\n");
+  exit(1);
+}
+
+// Blocks in each of the two copies of the log header, as
+// initlog() computes it: enough for an entry per log block
+// after the copies. A header is n, seq, cksum, and the entries.
+int
+loghead(int nlog)
+{
+  int nhead;
+
+  for(nhead = 1; 3*sizeof(uint) + (nlog - 2*nhead)*sizeof(int) > nhead*bsize; nhead++)
+    ;
+  return nhead;
+}
+
 int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
-    exit(1);
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-b") == 0)
+      bsize = atoi(argv[2]);
+    else if(strcmp(argv[1], "-l") == 0)
+      nlog = atoi(argv[2]);
+    else
+      break;
+    argv += 2;
+    argc -= 2;
   }
-
-  assert((BSIZE % sizeof(struct dinode)) == 0);
-  assert((BSIZE % sizeof(struct dirent)) == 0);
+  if(argc < 2 || bsize < BSIZE || bsize > MAXBSIZE || (bsize & (bsize - 1)) != 0 ||
+     nlog <= 0 || nlog > LOGMAX)
+    usage();
+  // the kernel needs room for MAXOPBLOCKS entries after the
+  // two header copies (see initlog()).
+  if(nlog - 2*loghead(nlog) < MAXOPBLOCKS)
+    usage();
+
+  assert((bsize % sizeof(struct dinode)) == 0);
+  assert((bsize % sizeof(struct dirent)) == 0);
+
+  // FSSIZE is in BSIZE blocks; keep the image the same size.
+  // 1 fs block = bsize/512 disk sectors
+  sb.bsize = bsize;
+  fssize = FSSIZE * BSIZE / bsize;
+  nsb = SBOFF / bsize + 1;
+  nbitmap = fssize/(bsize*8) + 1;
+  ninodeblocks = NINODES / IPB(sb) + 1;
+  nibitmap = NINODES/(bsize*8) + 1;
+  nmeta = nsb + nlog + ninodeblocks + nibitmap + nbitmap;
+  nblocks = fssize - nmeta;
+  if(nmeta >= fssize)
+    usage();
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -90,30 +144,31 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
-
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
-  sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logstart = xint(nsb);
+  sb.inodestart = xint(nsb+nlog);
+  sb.ibmapstart = xint(nsb+nlog+ninodeblocks);
+  sb.bmapstart = xint(nsb+nlog+ninodeblocks+nibitmap);
+  sb.bsize = xint(bsize);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode map blocks %u, bitmap blocks %u) blocks %d total %d of %u bytes\n",
+         nmeta, nlog, ninodeblocks, nibitmap, nbitmap, nblocks, fssize, bsize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // zero the whole image with one call rather than a write per block.
+  if(ftruncate(fsfd, (off_t)fssize * bsize) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF % bsize, &sb, sizeof(sb));
+  wsect(SBOFF / bsize, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -157,7 +212,7 @@ main(int argc, char *argv[])
     strncpy(de.name, shortname, DIRSIZ);
     iappend(rootino, &de, sizeof(de));
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
+    while((cc = read(fd, buf, bsize)) > 0)
       iappend(inum, buf, cc);
 
     close(fd);
@@ -166,11 +221,12 @@ main(int argc, char *argv[])
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  off = ((off/bsize) + 1) * bsize;
   din.size = xint(off);
   winode(rootino, &din);
 
   balloc(freeblock);
+  imap(freeinode);
 
   exit(0);
 }
@@ -178,11 +234,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, (off_t)sec * bsize, 0) != (off_t)sec * bsize){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
+  if(write(fsfd, buf, bsize) != bsize){
     perror("write");
     exit(1);
   }
@@ -191,13 +247,13 @@ wsect(uint sec, void *buf)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(sb));
   *dip = *ip;
   wsect(bn, buf);
 }
@@ -205,24 +261,24 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[BSIZE];
+  char buf[MAXBSIZE];
   uint bn;
   struct dinode *dip;
 
   bn = IBLOCK(inum, sb);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
+  dip = ((struct dinode*)buf) + (inum % IPB(sb));
   *ip = *dip;
 }
 
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+  if(lseek(fsfd, (off_t)sec * bsize, 0) != (off_t)sec * bsize){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
+  if(read(fsfd, buf, bsize) != bsize){
     perror("read");
     exit(1);
   }
@@ -245,12 +301,12 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar buf[MAXBSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
+  assert(used < bsize*8);
+  bzero(buf, bsize);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
@@ -258,30 +314,46 @@ balloc(int used)
   wsect(sb.bmapstart, buf);
 }
 
+// Mark inodes 0 .. used-1 in use; inode 0 is never allocated.
+void
+imap(int used)
+{
+  uchar buf[MAXBSIZE];
+  int i;
+
+  assert(used < bsize*8);
+  bzero(buf, bsize);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  printf("imap: write inode map block at sector %d\n", sb.ibmapstart);
+  wsect(sb.ibmapstart, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
-  uint fbn, off, n1;
+  uint fbn, off, n1, i;
   struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
+  char buf[MAXBSIZE];
+  uint indirect[MAXBSIZE / sizeof(uint)];
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
-    fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
+    fbn = off / bsize;
+    assert(fbn < MAXFILE(sb));
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT(sb)){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -291,10 +363,29 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      // double-indirect: the block listing the indirect
+      // block, then that indirect block.
+      i = fbn - NDIRECT - NINDIRECT(sb);
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      if(indirect[i / NINDIRECT(sb)] == 0){
+        indirect[i / NINDIRECT(sb)] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      x = xint(indirect[i / NINDIRECT(sb)]);
+      rsect(x, (char*)indirect);
+      if(indirect[i % NINDIRECT(sb)] == 0){
+        indirect[i % NINDIRECT(sb)] = xint(freeblock++);
+        wsect(x, (char*)indirect);
+      }
+      x = xint(indirect[i % NINDIRECT(sb)]);
     }
-    n1 = min(n, (fbn + 1) * BSIZE - off);
+    n1 = min(n, (fbn + 1) * bsize - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
+    bcopy(p, buf + off - (fbn * bsize), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -4,16 +4,19 @@
 #include "kernel/stat.h"
 #include "kernel/riscv.h"
 #include "kernel/fs.h"
+#include "kernel/iostat.h"
 #include "user/user.h"
 
 void test0();
 void test1();
+void test2();
 
 int
 main(int argc, char *argv[])
 {
   test0();
   test1();
+  test2();
   exit(0);
 }
 
@@ -168,3 +171,66 @@ void test1()
   }
   printf("test1 OK\n");
 }
+
+// Metadata stays cached across a big sequential write of an
+// extent file: the file's blocks are used once and cycle
+// through the cold lists. Only shows anything once the write
+// is bigger than the cache (see the evictions printed).
+void test2()
+{
+  char file[3], buf[BSIZE];
+  struct bcachestat st0, st1, st2;
+  struct stat st;
+  enum { NMETA = 20, BIG = 800 };
+  int fd, i;
+
+  printf("start test2\n");
+  if(mkdir("M") < 0){
+    printf("mkdir failed\n");
+    exit(-1);
+  }
+  file[0] = 'M';
+  file[1] = '/';
+  for(i = 0; i < NMETA; i++){
+    file[2] = 'a' + i;
+    createfile(file, 0);
+  }
+
+  bcachestat(&st0);
+  fd = open("E", O_CREATE | O_RDWR | O_EXTENT);
+  if(fd < 0){
+    printf("test2 create E failed\n");
+    exit(-1);
+  }
+  memset(buf, 'e', sizeof(buf));
+  for(i = 0; i < BIG; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("write E failed\n");
+      exit(-1);
+    }
+  }
+  close(fd);
+
+  bcachestat(&st1);
+  for(i = 0; i < NMETA; i++){
+    file[2] = 'a' + i;
+    if(stat(file, &st) < 0){
+      printf("test2 stat failed\n");
+      exit(-1);
+    }
+  }
+  bcachestat(&st2);
+  printf("test2: %d evictions during the write, %d metadata misses after\n",
+         (int)(st1.evict - st0.evict), (int)(st2.miss - st1.miss));
+
+  for(i = 0; i < NMETA; i++){
+    file[2] = 'a' + i;
+    unlink(file);
+  }
+  unlink("M");
+  unlink("E");
+  if(st2.miss == st1.miss)
+    printf("test2 OK\n");
+  else
+    printf("test2: FAIL\n");
+}
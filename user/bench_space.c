@@ -19,9 +19,12 @@ get_start_block(char *filename)
   if(stat(filename, &st) < 0) return 0;
   
   // For T_FILE, addrs[0] is the first block.
-  // For T_EXTENT, we must unpack the first extent.
+  // For T_EXTENT, we must look at the extent tree's root.
   if(st.type == 4) { // T_EXTENT
-      return (st.addrs[0] >> 8); // EXTENT_ADDR macro logic
+      struct extent_header *eh = (struct extent_header*)st.addrs;
+      if(eh->nent == 0) return 0;
+      if(eh->depth > 0) return EXT_IDX(eh)[0].child; // first index node
+      return EXT_LEAF(eh)[0].pblk;
   }
   
   // For T_INLINE, there is no block!
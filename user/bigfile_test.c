@@ -8,11 +8,6 @@
 #define O_EXTENT 0x800
 #endif
 
-#ifndef EXTENT_ADDR
-#define EXTENT_ADDR(x) ((x) >> 8)
-#define EXTENT_LEN(x) ((x) & 0xFF)
-#endif
-
 void
 panic(char *s)
 {
@@ -50,32 +45,46 @@ verify_blocks(int fd, int n, int pattern_offset)
   }
 }
 
+// Print the extents in the root of a file's extent tree,
+// and return how many there are (-1 if the root is an index).
+int
+print_extents(char *name)
+{
+  struct stat st;
+  if(stat(name, &st) < 0) panic("stat failed");
+
+  struct extent_header *eh = (struct extent_header*)st.addrs;
+  if(eh->depth > 0) {
+    printf("  Depth %d, %d index entries\n", eh->depth, eh->nent);
+    return -1;
+  }
+  for(int i = 0; i < eh->nent; i++) {
+    struct extent *ex = &EXT_LEAF(eh)[i];
+    printf("  Extent %d: Block %d, Addr %d, Len %d\n", i, ex->lblk, ex->pblk, ex->len);
+  }
+  return eh->nent;
+}
+
 void
 test_overflow()
 {
-  printf("\n=== TEST 1: Max Extent Length (260 Blocks) ===\n");
+  printf("\n=== TEST 1: Long Extents (260 Blocks) ===\n");
   int fd = open("test_ovf", O_CREATE | O_RDWR | O_EXTENT);
   if(fd < 0) panic("create failed");
 
-  // Write 260 blocks. Max extent len is 255.
-  // We expect: 1 Extent of 255, 1 Extent of 5.
+  // Extent lengths are 32 bits, so a file written
+  // sequentially should need only a few extents.
   printf("Writing 260 blocks...\n");
   write_blocks(fd, 260, 0);
   close(fd);
 
-  struct stat st;
-  if(stat("test_ovf", &st) < 0) panic("stat failed");
-  
-  int ext_count = 0;
-  for(int i=0; i<12; i++) {
-    if(st.addrs[i]) {
-        printf("  Slot %d: Len %d\n", i, EXTENT_LEN(st.addrs[i]));
-        ext_count++;
-    }
-  }
+  int ext_count = print_extents("test_ovf");
+  if(ext_count < 1) panic("Expected the extents in the root!");
 
-  if(ext_count < 2) panic("Expected at least 2 extents for 260 blocks!");
-  printf("PASS: Overflow handled correctly.\n");
+  fd = open("test_ovf", O_RDONLY);
+  verify_blocks(fd, 260, 0);
+  close(fd);
+  printf("PASS: 260 blocks in %d extents.\n", ext_count);
   unlink("test_ovf");
 }
 
@@ -112,21 +121,10 @@ test_fragmentation()
   close(fd_d);
 
   // Step 4: Verify File D Metadata
-  struct stat st;
-  if(stat("file_d", &st) < 0) panic("stat file_d failed");
-  
-  int ext_count = 0;
   printf("File D Layout:\n");
-  for(int i=0; i<12; i++) {
-    if(st.addrs[i]) {
-        uint addr = EXTENT_ADDR(st.addrs[i]);
-        uint len = EXTENT_LEN(st.addrs[i]);
-        printf("  Slot %d: Addr %d, Len %d\n", i, addr, len);
-        ext_count++;
-    }
-  }
+  int ext_count = print_extents("file_d");
 
-  if(ext_count < 2) {
+  if(ext_count >= 0 && ext_count < 2) {
      printf("WARN: File D fits in one extent? (Disk might not be fragmented as expected)\n");
   } else {
      printf("PASS: File D split into multiple extents to handle fragmentation.\n");
@@ -144,6 +142,66 @@ test_fragmentation()
   unlink("file_d");
 }
 
+void
+test_many_extents()
+{
+  printf("\n=== TEST 3: Many Extents (Extent Tree) ===\n");
+
+  // Append to two files in turn, allocating each block with
+  // fallocate() so that nothing is preallocated: each block of
+  // each file becomes an extent of its own, far more than fit
+  // in the inode.
+  int n = 200;
+  int fd_a = open("file_e", O_CREATE | O_RDWR | O_EXTENT);
+  int fd_b = open("file_f", O_CREATE | O_RDWR | O_EXTENT);
+  if(fd_a < 0 || fd_b < 0) panic("create failed");
+  char buf[1024];
+  for(int i = 0; i < n; i++){
+    memset(buf, i % 26 + 'a', sizeof(buf));
+    if(fallocate(fd_a, i * 1024, 1024) < 0 || fallocate(fd_b, i * 1024, 1024) < 0)
+      panic("fallocate failed");
+    if(write(fd_a, buf, sizeof(buf)) != sizeof(buf)) panic("write a failed");
+    if(write(fd_b, buf, sizeof(buf)) != sizeof(buf)) panic("write b failed");
+  }
+  close(fd_a);
+  close(fd_b);
+
+  if(print_extents("file_e") >= 0)
+    printf("WARN: file_e fits in the inode? (blocks may be contiguous)\n");
+
+  printf("Verifying data integrity...\n");
+  fd_a = open("file_e", O_RDONLY);
+  verify_blocks(fd_a, n, 0);
+  close(fd_a);
+  fd_b = open("file_f", O_RDONLY);
+  verify_blocks(fd_b, n, 0);
+  close(fd_b);
+  printf("PASS: %d blocks read back through the extent tree.\n", n);
+
+  unlink("file_e");
+  unlink("file_f");
+}
+
+void
+test_no_space()
+{
+  printf("\n=== TEST 4: fallocate() Past the Free Space ===\n");
+
+  int fd = open("file_g", O_CREATE | O_RDWR | O_EXTENT);
+  if(fd < 0) panic("create failed");
+  if(fallocate(fd, 0, 0x7fffffff) != -1)
+    panic("fallocate of 2GB succeeded");
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.size != 0)
+    panic("failed fallocate changed the file");
+  // the file system still works.
+  if(fallocate(fd, 0, 4 * 1024) < 0)
+    panic("fallocate failed");
+  close(fd);
+  unlink("file_g");
+  printf("PASS: fallocate() returned -1 when the disk was too small.\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -151,6 +209,8 @@ main(int argc, char *argv[])
   
   test_overflow();
   test_fragmentation();
+  test_many_extents();
+  test_no_space();
 
   printf("\nALL TESTS PASSED.\n");
   exit(0);
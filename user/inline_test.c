@@ -39,41 +39,51 @@ fmt_name(char *buf, int id)
   }
 }
 
-// --- TEST 1: CAPACITY LIMITS (STRICT) ---
+// --- TEST 1: PROMOTION AND DEMOTION ---
 void
 test_capacity()
 {
-  printf("\n=== TEST 1: Capacity Check (Strict Mode) ===\n");
-  int fd = open("in_cap", O_CREATE | O_RDWR | O_INLINE);
+  printf("\n=== TEST 1: Promotion & Demotion ===\n");
+  int fd = open("in_cap", O_CREATE | O_RDWR);
   if(fd < 0) panic("create failed");
 
-  // Try to write a large buffer
+  struct stat st;
+  if(fstat(fd, &st) < 0) panic("fstat failed");
+  if(st.type != T_INLINE) panic("New file isn't inline");
+
+  // Write a little, then more than fits in the inode.
   char buf[512];
   memset(buf, 'X', 512);
-  
-  printf("Attempting to write 512 bytes to inline file...\n");
+  if(write(fd, "Small", 5) != 5) panic("Small write failed");
+  printf("Writing 512 more bytes to inline file...\n");
   int n = write(fd, buf, 512);
-  
-  // EXPECTATION: -1 (Error) because 512 > 116 (or 52)
-  if(n != -1) {
+  if(n != 512) {
     printf("Write returned: %d\n", n);
-    panic("Write succeeded! Expected error (-1) due to overflow.");
+    panic("Write to a growing inline file failed");
+  }
+  if(fstat(fd, &st) < 0) panic("fstat failed");
+  if(st.type != T_FILE || st.size != 517) {
+    printf("Type %d, size %l\n", st.type, st.size);
+    panic("File wasn't promoted to blocks");
   }
-  
-  printf("Write returned -1 (Expected).\n");
   close(fd);
 
-  // Verify size is 0 (Atomicity check)
-  // The file should be empty because the write was rejected entirely.
-  struct stat st;
-  stat("in_cap", &st);
-  if(st.size != 0) {
-      printf("Stat size: %l\n", st.size);
-      panic("Stat size mismatch! File should be empty.");
-  }
-  
+  // The inline data moved with it.
+  fd = open("in_cap", O_RDONLY);
+  char got[517];
+  if(read(fd, got, 517) != 517) panic("Read back failed");
+  if(memcmp(got, "Small", 5) != 0 || memcmp(got + 5, buf, 512) != 0)
+    panic("Data lost in promotion");
+  close(fd);
+
+  // Truncating brings it back into the inode.
+  fd = open("in_cap", O_RDWR | O_TRUNC);
+  if(fstat(fd, &st) < 0) panic("fstat failed");
+  if(st.type != T_INLINE || st.size != 0) panic("Truncated file wasn't demoted");
+  close(fd);
+
   unlink("in_cap");
-  printf("PASS: Capacity strictly enforced.\n");
+  printf("PASS: Inline files grow into blocks and shrink back.\n");
 }
 
 // --- TEST 2: TRUNCATION & REWRITE ---
@@ -121,9 +131,13 @@ test_trojan()
 {
   printf("\n=== TEST 3: Safety Check (The Trojan Delete) ===\n");
   
-  // 1. Create a Standard File (The Victim)
+  // 1. Create a Standard File (The Victim), big enough to
+  // need a block.
+  char pad[100];
+  memset(pad, 'v', sizeof(pad));
   int fd_vic = open("victim", O_CREATE | O_RDWR); 
   write(fd_vic, "VictimData", 10);
+  write(fd_vic, pad, sizeof(pad));
   struct stat st_vic;
   fstat(fd_vic, &st_vic);
   
@@ -147,6 +161,7 @@ test_trojan()
   // 4. Create a NEW file to see if Block was freed
   int fd_new = open("attacker", O_CREATE | O_RDWR);
   write(fd_new, "Overwrit", 8);
+  write(fd_new, pad, sizeof(pad));
   struct stat st_new;
   fstat(fd_new, &st_new);
   uint new_block = st_new.addrs[0];
@@ -209,15 +224,78 @@ test_mass()
     printf("PASS: Mass creation/deletion successful.\n");
 }
 
+// --- TEST 5: INLINE DIRECTORIES ---
+void
+make_file(char *path, char c)
+{
+  int fd = open(path, O_CREATE | O_RDWR);
+  if(fd < 0) panic("create in directory failed");
+  if(write(fd, &c, 1) != 1) panic("write in directory failed");
+  close(fd);
+}
+
+void
+check_file(char *path, char c)
+{
+  char got = 0;
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) panic("open in directory failed");
+  if(read(fd, &got, 1) != 1 || got != c) panic("file in directory corrupted");
+  close(fd);
+}
+
+void
+test_dirs()
+{
+  printf("\n=== TEST 5: Inline Directories ===\n");
+  struct stat st;
+
+  // ".", ".." and one name fit in the inode.
+  if(mkdir("in_dir") < 0) panic("mkdir failed");
+  if(stat("in_dir", &st) < 0) panic("stat failed");
+  if(st.type != T_DIR || st.size != 2 * sizeof(struct dirent))
+    panic("New directory has the wrong size");
+  make_file("in_dir/a", 'a');
+  if(stat("in_dir", &st) < 0) panic("stat failed");
+  if(st.size != 3 * sizeof(struct dirent)) panic("Third entry wasn't added");
+  check_file("in_dir/a", 'a');
+  if(unlink("in_dir") >= 0) panic("Removed a non-empty directory");
+
+  // the next name moves the entries to a block.
+  make_file("in_dir/b", 'b');
+  if(stat("in_dir", &st) < 0) panic("stat failed");
+  if(st.size <= sizeof(st.addrs)) panic("Directory wasn't promoted to a block");
+  check_file("in_dir/a", 'a');
+  check_file("in_dir/b", 'b');
+  if(chdir("in_dir") < 0) panic("chdir failed");
+  check_file("a", 'a');
+  if(chdir("..") < 0) panic("chdir .. failed");
+  if(stat("in_dir/../in_dir/b", &st) < 0) panic("lookup through .. failed");
+
+  // rmdir afterwards.
+  if(unlink("in_dir/a") < 0 || unlink("in_dir/b") < 0) panic("unlink in directory failed");
+  if(unlink("in_dir") < 0) panic("rmdir of promoted directory failed");
+  if(stat("in_dir", &st) >= 0) panic("Directory still there");
+
+  // and of a directory that never left the inode.
+  if(mkdir("in_dir2") < 0) panic("mkdir failed");
+  make_file("in_dir2/x", 'x');
+  if(unlink("in_dir2/x") < 0) panic("unlink in directory failed");
+  if(unlink("in_dir2") < 0) panic("rmdir of inline directory failed");
+
+  printf("PASS: Directories grow from the inode into a block.\n");
+}
+
 int
 main(int argc, char *argv[])
 {
-  printf("--- INLINE FILE STRESS TEST (STRICT MODE) ---\n");
+  printf("--- INLINE FILE STRESS TEST ---\n");
   
   test_capacity();
   test_rewrite();
   test_trojan();
   test_mass();
+  test_dirs();
 
   printf("\nALL TESTS PASSED.\n");
   exit(0);
@@ -0,0 +1,97 @@
+// Print buffer cache and disk statistics.
+//
+//   iostat                   totals since boot
+//   iostat interval [count]  then changes every interval ticks
+
+#include "kernel/types.h"
+#include "kernel/iostat.h"
+#include "user/user.h"
+
+static void
+getstats(struct bcachestat *c, struct diskstat *d)
+{
+  if(bcachestat(c) < 0 || diskstat(d) < 0){
+    fprintf(2, "iostat: cannot get statistics\n");
+    exit(1);
+  }
+}
+
+// Print the latency histograms, skipping empty bins.
+static void
+lathist(struct diskstat *d, struct diskstat *o)
+{
+  uint64 r, w;
+  int i;
+
+  printf("  latency(us)     reads    writes\n");
+  for(i = 0; i < NLATBIN; i++){
+    r = d->rlat[i] - o->rlat[i];
+    w = d->wlat[i] - o->wlat[i];
+    if(r == 0 && w == 0)
+      continue;
+    if(i < NLATBIN-1)
+      printf("  < %d\t\t%l\t%l\n", 2 << i, r, w);
+    else
+      printf("  >= %d\t\t%l\t%l\n", 1 << i, r, w);
+  }
+}
+
+// Print the changes from (oc, od) to (c, d).
+static void
+report(struct bcachestat *c, struct bcachestat *oc,
+       struct diskstat *d, struct diskstat *od)
+{
+  uint64 hit, miss, nreq;
+
+  hit = c->hit - oc->hit;
+  miss = c->miss - oc->miss;
+  printf("cache: %l hits, %l misses", hit, miss);
+  if(hit + miss > 0)
+    printf(" (%l%% hits)", hit * 100 / (hit + miss));
+  printf(", %l evictions\n", c->evict - oc->evict);
+  printf("  %l read ahead, %l of them used\n", c->ra - oc->ra, c->rahit - oc->rahit);
+  printf("  %d/%d buffers, %d hot, %d dirty, %d pinned\n",
+         c->nbuf, c->maxbuf, c->hot, c->dirty, c->pinned);
+
+  nreq = d->nreq - od->nreq;
+  printf("disk: %l requests, %l blocks, %l kicks",
+         nreq, d->nblock - od->nblock, d->nkick - od->nkick);
+  if(nreq > 0)
+    printf(", avg depth %l", (d->depthsum - od->depthsum) / nreq);
+  printf(", max depth %d\n", d->maxdepth);
+  lathist(d, od);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat c, oc;
+  struct diskstat d, od;
+  int interval = 1, count = -1;
+
+  if(argc > 1)
+    interval = atoi(argv[1]);
+  if(argc > 3 || interval <= 0){
+    fprintf(2, "Usage: iostat [interval [count]]\n");
+    exit(1);
+  }
+  if(argc > 2)
+    count = atoi(argv[2]);
+
+  memset(&oc, 0, sizeof(oc));
+  memset(&od, 0, sizeof(od));
+  getstats(&c, &d);
+  report(&c, &oc, &d, &od);
+  if(argc == 1)
+    exit(0);
+
+  while(count < 0 || --count > 0){
+    oc = c;
+    od = d;
+    sleep(interval);
+    getstats(&c, &d);
+    printf("\n");
+    report(&c, &oc, &d, &od);
+  }
+  exit(0);
+}
@@ -4,7 +4,9 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-#define NUMBLOCKS 1024
+// more than a pointer-based file can hold, but small enough
+// for the default fs.img.
+#define NUMBLOCKS 512
 
 char buf[BSIZE] = { 0 };
 
@@ -14,7 +16,7 @@ main(int argc, char *argv[])
   int fd;
 
   for (int i = 0; i < 10; i++) {
-    fd = open("alargefile.txt", O_CREATE | O_TRUNC | O_RDWR);
+    fd = open("alargefile.txt", O_CREATE | O_TRUNC | O_RDWR | O_EXTENT);
     if (fd < 0) {
       printf("cannot open alargefile.txt\n");
       exit(1);
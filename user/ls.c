@@ -43,6 +43,8 @@ ls(char *path)
 
   switch(st.type){
   case T_FILE:
+  case T_EXTENT:
+  case T_INLINE:
     printf("%s %d %d %l\n", fmtname(path), st.type, st.ino, st.size);
     break;
 
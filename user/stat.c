@@ -1,7 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
-#include "kernel/fs.h" // Needed for the macros
+#include "kernel/fs.h" // Needed for the extent structs
 
 int
 main(int argc, char *argv[])
@@ -23,16 +23,16 @@ main(int argc, char *argv[])
   printf("Size: %lu\n", st.size);
 
   if(st.type == T_EXTENT) {
-    printf("--- Extents ---\n");
-    for(int i = 0; i < 12; i++) { // Only check direct blocks
-      uint entry = st.addrs[i];
-      
-      if(entry == 0) continue;
-
-      uint addr = EXTENT_ADDR(entry);
-      uint len  = EXTENT_LEN(entry);
-      
-      printf("Slot %d: Start Block %d, Length %d\n", i, addr, len);
+    struct extent_header *eh = (struct extent_header*)st.addrs;
+    printf("--- Extents (depth %d) ---\n", eh->depth);
+    for(int i = 0; i < eh->nent; i++) {
+      if(eh->depth == 0) {
+        struct extent *ex = &EXT_LEAF(eh)[i];
+        printf("Block %d: Start Block %d, Length %d\n", ex->lblk, ex->pblk, ex->len);
+      } else {
+        struct extent_idx *ix = &EXT_IDX(eh)[i];
+        printf("Block %d: Index Node %d\n", ix->lblk, ix->child);
+      }
     }
   } else if(st.type == T_INLINE) { // Type 5
      printf("Type: Inline File\n");
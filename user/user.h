@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct diskstat;
+struct bcachestat;
 
 // system calls
 int fork(void);
@@ -25,6 +27,11 @@ int sleep(int);
 int uptime(void);
 int ntas();
 int nfree();
+int diskstat(struct diskstat*);
+int bcachestat(struct bcachestat*);
+int fsync(int);
+int sync(void);
+int fallocate(int, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
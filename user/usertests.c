@@ -18,6 +18,10 @@
 //
 
 #define BUFSZ  (MAXOPBLOCKS+2)*BSIZE
+// MAXFILE for BSIZE-byte blocks (direct + single-indirect).
+// The kernel's MAXFILE also counts the double-indirect blocks,
+// so it's larger; this is just the size of the big file tests.
+#define NFILEBLOCKS (NDIRECT + BSIZE / sizeof(uint))
 
 char buf[BUFSZ];
 char name[3];
@@ -312,6 +316,90 @@ writetest(char *s)
   }
 }
 
+// fsync() and sync() commit what was written, and fsync()
+// refuses what isn't a file. Several processes at once wait
+// on the same commits.
+void
+fsynctest(char *s)
+{
+  enum { N=4, SZ=512 };
+  int fd, i, pid, xstatus, fds[2];
+  char name[3];
+
+  for(pid = 0; pid < N; pid++){
+    if((i = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(i == 0){
+      name[0] = 'y';
+      name[1] = '0' + pid;
+      name[2] = 0;
+      fd = open(name, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("%s: create %s failed\n", s, name);
+        exit(1);
+      }
+      memset(buf, '0' + pid, SZ);
+      for(i = 0; i < 4; i++){
+        if(write(fd, buf, SZ) != SZ){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        if(fsync(fd) != 0){
+          printf("%s: fsync %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      close(fd);
+      exit(0);
+    }
+  }
+  for(pid = 0; pid < N; pid++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  if(sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
+
+  for(pid = 0; pid < N; pid++){
+    name[0] = 'y';
+    name[1] = '0' + pid;
+    name[2] = 0;
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || read(fd, buf, sizeof(buf)) != 4*SZ){
+      printf("%s: read %s failed\n", s, name);
+      exit(1);
+    }
+    for(i = 0; i < 4*SZ; i++){
+      if(buf[i] != '0' + pid){
+        printf("%s: %s has wrong contents\n", s, name);
+        exit(1);
+      }
+    }
+    close(fd);
+    unlink(name);
+  }
+
+  if(fsync(-1) != -1 || fsync(NOFILE) != -1){
+    printf("%s: fsync of a bad fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 void
 writebig(char *s)
 {
@@ -323,7 +411,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NFILEBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", i);
@@ -343,7 +431,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == NFILEBLOCKS - 1){
         printf("%s: read only %d blocks from big", n);
         exit(1);
       }
@@ -2293,6 +2381,7 @@ main(int argc, char *argv[])
     {stacktest, "stacktest"},
     {opentest, "opentest"},
     {writetest, "writetest"},
+    {fsynctest, "fsynctest"},
     {writebig, "writebig"},
     {createtest, "createtest"},
     {openiputtest, "openiput"},
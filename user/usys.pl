@@ -38,3 +38,8 @@ entry("sleep");
 entry("uptime");
 entry("ntas");
 entry("nfree");
+entry("diskstat");
+entry("bcachestat");
+entry("fsync");
+entry("sync");
+entry("fallocate");